@@ -0,0 +1,437 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+//Micro-benchmarks of the utility hot paths on synthetic data
+//Usage: cpp-utils-bench [--filter substring] [--json outfile] [--seed n] [--scale s] [--mintime seconds]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+
+#include "logger.h"
+#include "general_utils.h"
+#include "file_utils.h"
+#include "vector_utils.h"
+#include "radius_searcher.h"
+#include "ndarray.h"
+#include "blocklanguage.h"
+#include "asciicolumnfile.h"
+#include "synthetic_survey.h"
+#include "random_utils.h"
+#include "general_types.h"
+
+cLogger glog;
+
+//Stops the optimiser discarding benchmark results
+static volatile double gsink = 0.0;
+
+class cBenchResult{
+
+public:
+	std::string name;
+	size_t iterations = 0;
+	size_t itemsperiteration = 0;
+	double seconds = 0.0;
+
+	double nsperiteration() const { return 1.0e9*seconds / (double)iterations; }
+	double itemspersecond() const { return (double)(iterations*itemsperiteration) / seconds; }
+};
+
+class cBenchmarks{
+
+public:
+	std::string filter;
+	double mintime = 0.25;
+	std::vector<cBenchResult> results;
+
+	//Doubles the iteration count until a run takes at least mintime
+	void run(const std::string& name, const size_t itemsperiteration, const std::function<void()>& f){
+		if (filter.size() > 0 && name.find(filter) == std::string::npos) return;
+
+		f();//warm up
+		size_t n = 1;
+		double t = 0.0;
+		while (true){
+			auto t0 = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++) f();
+			auto t1 = std::chrono::steady_clock::now();
+			t = std::chrono::duration<double>(t1 - t0).count();
+			if (t >= mintime) break;
+			n *= 2;
+		}
+
+		cBenchResult r;
+		r.name = name;
+		r.iterations = n;
+		r.itemsperiteration = itemsperiteration;
+		r.seconds = t;
+		results.push_back(r);
+		std::printf("%-36s %12zu %16.1lf %16.4le\n", name.c_str(), n, r.nsperiteration(), r.itemspersecond());
+		std::fflush(stdout);
+	}
+
+	bool writejson(const std::string& path, const unsigned int seed, const double scale) const {
+		FILE* fp = fopen(path.c_str(), "w");
+		if (fp == NULL) return false;
+		fprintf(fp, "{\n");
+		fprintf(fp, "  \"timestamp\": \"%s\",\n", timestamp().c_str());
+		fprintf(fp, "  \"seed\": %u,\n", seed);
+		fprintf(fp, "  \"scale\": %g,\n", scale);
+		fprintf(fp, "  \"benchmarks\": [\n");
+		for (size_t i = 0; i < results.size(); i++){
+			const cBenchResult& r = results[i];
+			fprintf(fp, "    {\"name\": \"%s\", \"iterations\": %zu, \"items_per_iteration\": %zu, \"seconds\": %.9lf, \"ns_per_iteration\": %.3lf, \"items_per_second\": %.6le}%s\n",
+				r.name.c_str(), r.iterations, r.itemsperiteration, r.seconds, r.nsperiteration(), r.itemspersecond(), i + 1 < results.size() ? "," : "");
+		}
+		fprintf(fp, "  ]\n}\n");
+		fclose(fp);
+		return true;
+	}
+};
+
+//Synthetic data generators, deterministic for a given seed
+std::vector<double> uniformvector(std::mt19937_64& rng, const size_t n, const double lo, const double hi){
+	std::uniform_real_distribution<double> u(lo, hi);
+	std::vector<double> v(n);
+	for (size_t i = 0; i < n; i++) v[i] = u(rng);
+	return v;
+}
+
+std::vector<double> ascendingvector(std::mt19937_64& rng, const size_t n){
+	std::uniform_real_distribution<double> u(0.1, 1.0);
+	std::vector<double> v(n);
+	double x = 0.0;
+	for (size_t i = 0; i < n; i++){
+		x += u(rng);
+		v[i] = x;
+	}
+	return v;
+}
+
+std::string datarecord(std::mt19937_64& rng, const size_t ncolumns){
+	std::uniform_real_distribution<double> u(-1000.0, 1000.0);
+	std::string s;
+	for (size_t i = 0; i < ncolumns; i++){
+		s += strprint("%12.4lf", u(rng));
+	}
+	return s;
+}
+
+void writedatafile(std::mt19937_64& rng, const std::string& path, const size_t nrecords, const size_t ncolumns){
+	FILE* fp = fileopen(path, "w");
+	for (size_t i = 0; i < nrecords; i++){
+		fprintf(fp, "%s\n", datarecord(rng, ncolumns).c_str());
+	}
+	fclose(fp);
+}
+
+void writecontrolfile(std::mt19937_64& rng, const std::string& path, const size_t nblocks, const size_t nentries){
+	std::uniform_real_distribution<double> u(0.0, 100.0);
+	FILE* fp = fileopen(path, "w");
+	fprintf(fp, "Control Begin\n");
+	for (size_t b = 0; b < nblocks; b++){
+		fprintf(fp, "\tBlock%zu Begin\n", b);
+		for (size_t e = 0; e < nentries; e++){
+			fprintf(fp, "\t\tEntry%zu = %lf\n", e, u(rng));
+		}
+		fprintf(fp, "\tBlock%zu End\n", b);
+	}
+	fprintf(fp, "Control End\n");
+	fclose(fp);
+}
+
+int main(int argc, char** argv)
+{
+	std::string jsonpath;
+	std::string filter;
+	unsigned int seed = 1;
+	double scale = 1.0;
+	double mintime = 0.25;
+	for (int i = 1; i < argc; i++){
+		std::string a = argv[i];
+		if (a == "--json" && i + 1 < argc) jsonpath = argv[++i];
+		else if (a == "--filter" && i + 1 < argc) filter = argv[++i];
+		else if (a == "--seed" && i + 1 < argc) seed = (unsigned int)std::atoi(argv[++i]);
+		else if (a == "--scale" && i + 1 < argc) scale = std::atof(argv[++i]);
+		else if (a == "--mintime" && i + 1 < argc) mintime = std::atof(argv[++i]);
+		else{
+			std::printf("Usage: %s [--filter substring] [--json outfile] [--seed n] [--scale s] [--mintime seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::mt19937_64 rng(seed);
+	cBenchmarks B;
+	B.filter = filter;
+	B.mintime = mintime;
+	auto scaled = [scale](const size_t n){ return std::max((size_t)1, (size_t)(scale*(double)n)); };
+
+	std::printf("%-36s %12s %16s %16s\n", "Benchmark", "Iterations", "ns/iteration", "items/second");
+
+	//fieldparsestring
+	{
+		const size_t ncolumns = 100;
+		const std::string record = datarecord(rng, ncolumns);
+		B.run("fieldparsestring", ncolumns, [&](){
+			std::vector<std::string> f = fieldparsestring(record.c_str(), " ,\t\r\n");
+			gsink += (double)f.size();
+		});
+	}
+
+	//cAsciiColumnFile delimited record parsing
+	{
+		const size_t nrecords = scaled(2000);
+		const size_t ncolumns = 50;
+		const std::string path = "cpp-utils-bench.tmp.dat";
+		writedatafile(rng, path, nrecords, ncolumns);
+		B.run("cAsciiColumnFile_parse", nrecords, [&](){
+			cAsciiColumnFile A(path);
+			double s = 0.0;
+			while (A.readnextrecord()){
+				A.parserecord();
+				double v;
+				A.getcolumn(ncolumns / 2, v);
+				s += v;
+			}
+			gsink += s;
+		});
+
+		B.run("countlines", nrecords, [&](){
+			gsink += (double)countlines(path);
+		});
+		deletefile(path);
+	}
+
+	//linearinterp
+	{
+		const size_t n = scaled(1000);
+		const size_t ni = scaled(10000);
+		std::vector<double> x = ascendingvector(rng, n);
+		std::vector<double> y = uniformvector(rng, n, 0.0, 1.0);
+		std::vector<double> xi = uniformvector(rng, ni, x.front(), x.back());
+		B.run("linearinterp", ni, [&](){
+			std::vector<double> yi = linearinterp(x, y, xi);
+			gsink += yi[ni / 2];
+		});
+
+		cSparseMatrix<double> R = linearinterpoperator(x, xi);
+		B.run("linearinterpoperator_multiply", ni, [&](){
+			std::vector<double> yi = R.multiply(y);
+			gsink += yi[ni / 2];
+		});
+	}
+
+	//cRadiusSearcher
+	{
+		const size_t n = scaled(100000);
+		const size_t nq = 1000;
+		std::vector<double> x = uniformvector(rng, n, 0.0, 100000.0);
+		std::vector<double> y = uniformvector(rng, n, 0.0, 100000.0);
+		std::vector<double> z = uniformvector(rng, n, 0.0, 100.0);
+		std::vector<double> qx = uniformvector(rng, nq, 0.0, 100000.0);
+		std::vector<double> qy = uniformvector(rng, nq, 0.0, 100000.0);
+		cRadiusSearcher S(x, y, z, 1000.0);
+		B.run("cRadiusSearcher_findneighbours", nq, [&](){
+			std::vector<double> d;
+			size_t count = 0;
+			for (size_t i = 0; i < nq; i++){
+				count += S.findneighbourstopoint(qx[i], qy[i], d).size();
+			}
+			gsink += (double)count;
+		});
+	}
+
+	//Structure of arrays distance filters against the per point cPnt equivalent
+	{
+		const size_t n = scaled(1000000);
+		std::vector<double> x = uniformvector(rng, n, 0.0, 100000.0);
+		std::vector<double> y = uniformvector(rng, n, 0.0, 100000.0);
+		const cPnt p(50000.0, 50000.0, 0.0);
+		const double r = 5000.0;
+		cPntArray A(x, y);
+		std::vector<size_t> index;
+		B.run("cPnt_distance_filter", n, [&](){
+			index.clear();
+			for (size_t i = 0; i < n; i++){
+				if (p.distance(cPnt(x[i], y[i], 0.0)) <= r) index.push_back(i);
+			}
+			gsink += (double)index.size();
+		});
+		B.run("cPntArray_withindistance", n, [&](){
+			gsink += (double)A.withindistance(p, r, index);
+		});
+		cPnt c;
+		size_t segment;
+		B.run("cPntArray_closestpoint", n, [&](){
+			gsink += A.closestpoint(p, c, segment);
+		});
+		B.run("cPntArray_boundingbox", n, [&](){
+			gsink += A.boundingbox().xmax;
+		});
+	}
+
+	//cNDArray element access
+	{
+		const size_t ni = 64, nj = 64, nk = scaled(64);
+		cNDArray<double, 3> A({ ni, nj, nk });
+		for (size_t i = 0; i < A.nelements(); i++) A.element(i) = (double)i;
+		B.run("cNDArray_access", ni*nj*nk, [&](){
+			double s = 0.0;
+			for (size_t i = 0; i < ni; i++){
+				for (size_t j = 0; j < nj; j++){
+					for (size_t k = 0; k < nk; k++){
+						s += A[i][j][k];
+					}
+				}
+			}
+			gsink += s;
+		});
+	}
+
+	//vector_utils operators
+	{
+		const size_t n = scaled(100000);
+		std::vector<double> a = uniformvector(rng, n, 0.0, 1.0);
+		std::vector<double> b = uniformvector(rng, n, 0.0, 1.0);
+		B.run("vector_utils_arithmetic", n, [&](){
+			std::vector<double> c = a * 2.0 + b - a / 3.0;
+			gsink += c[n / 2];
+		});
+	}
+
+	//cBlock lookups
+	{
+		const std::string path = "cpp-utils-bench.tmp.con";
+		const size_t nblocks = 20;
+		const size_t nentries = 20;
+		writecontrolfile(rng, path, nblocks, nentries);
+		cBlock C(path);
+		deletefile(path);
+		std::vector<std::string> ids;
+		for (size_t b = 0; b < nblocks; b++){
+			ids.push_back(strprint("Control.Block%zu.Entry%zu", b, (b * 7) % nentries));
+		}
+		B.run("cBlock_getdoublevalue", ids.size(), [&](){
+			double s = 0.0;
+			for (size_t i = 0; i < ids.size(); i++){
+				s += C.getdoublevalue(ids[i]);
+			}
+			gsink += s;
+		});
+	}
+
+	//Bulk random variates
+	{
+		const size_t n = scaled(1000000);
+		std::vector<double> x(n);
+		cPhiloxRandom P(seed);
+		B.run("cPhiloxRandom_urand", n, [&](){
+			P.urand(x, 0.0, 1.0);
+			gsink += x[n / 2];
+		});
+		B.run("cPhiloxRandom_nrand", n, [&](){
+			P.nrand(x, 0.0, 1.0);
+			gsink += x[n / 2];
+		});
+		cXoshiro256pp E(seed);
+		std::normal_distribution<double> N;
+		B.run("xoshiro256pp_normal_distribution", n, [&](){
+			for (size_t i = 0; i < n; i++) x[i] = N(E);
+			gsink += x[n / 2];
+		});
+	}
+
+	//Streaming histograms, also checks that integral types bin correctly
+	{
+		const size_t n = scaled(1000000);
+		std::vector<double> x(n);
+		std::vector<int> k(n);
+		std::normal_distribution<double> N;
+		for (size_t i = 0; i < n; i++){
+			x[i] = N(rng);
+			k[i] = (int)(i % 100);
+		}
+		cStreamingHistogram<double> H(-4.0, 4.0, 64);
+		B.run("cStreamingHistogram_add_double", n, [&](){
+			H.add(x.data(), n);
+			gsink += (double)H.count[32];
+		});
+		cStreamingHistogram<int> K(0, 100, 100);
+		B.run("cStreamingHistogram_add_int", n, [&](){
+			K.add(k.data(), n);
+			gsink += (double)K.count[50];
+		});
+
+		cStreamingHistogram<int> C(0, 10, 10);
+		for (int i = 0; i < 10; i++) C.add(i);
+		for (size_t i = 0; i < C.nbins(); i++){
+			if (C.count[i] != 1){
+				std::printf("cStreamingHistogram<int> put %d values in bin %d, expected 1\n", (int)C.count[i], (int)i);
+				return 1;
+			}
+		}
+	}
+
+	//Synthetic AEM survey readers
+	{
+		cSyntheticSurvey S(seed, scaled(20), 1000, 30);
+		const std::string dat = "cpp-utils-bench.tmp.survey.dat";
+		const std::string dfn = "cpp-utils-bench.tmp.survey.dfn";
+		const std::string db = "cpp-utils-bench.tmp.survey";
+		S.write_aseggdf(dat, dfn);
+		S.write_intrepid(db);
+
+		B.run("aseggdf_fixedwidth_parse", S.ntotal(), [&](){
+			cAsciiColumnFile A(dat);
+			A.parse_aseggdf2_header(dfn);
+			double s = 0.0;
+			std::vector<double> em;
+			while (A.readnextrecord()){
+				A.parserecord();
+				A.getfield(6, em);
+				s += em[0];
+			}
+			gsink += s;
+		});
+
+		{
+			ILDataset D(db);
+			B.run("intrepid_readbuffer", S.ntotal(), [&](){
+				ILField& F = D.getfield("EM");
+				double s = 0.0;
+				for (size_t li = 0; li < D.nlines(); li++){
+					ILSegment seg(F, li);
+					seg.createbuffer();
+					seg.readbuffer();
+					s += seg.d(0, 0);
+				}
+				gsink += s;
+			});
+		}
+
+		deletefile(dat);
+		deletefile(dfn);
+		std::vector<std::string> files = getfilelist(db, "");
+		for (size_t i = 0; i < files.size(); i++){
+			if (isdirectory(files[i]) == false) deletefile(files[i]);
+		}
+		std::remove(db.c_str());
+	}
+
+	if (jsonpath.size() > 0){
+		if (B.writejson(jsonpath, seed, scale) == false){
+			std::printf("Could not write %s\n", jsonpath.c_str());
+			return 1;
+		}
+	}
+	return 0;
+}
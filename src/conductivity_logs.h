@@ -10,12 +10,17 @@ Author: Ross C. Brodie, Geoscience Australia.
 #define _conductivity_logs_H
 
 #include <vector>
+#include <algorithm>
 
 #include "file_utils.h"
 #include "general_utils.h"
+#include "radius_searcher.h"
 
 class cConductivityLog{
 
+private:
+	bool indexvalid = false;
+
 public:
 	std::string name = "";
 	std::string source = "";
@@ -25,7 +30,13 @@ public:
 	double z = 0;
 	std::vector<double> depth;
 	std::vector<double> conductivity;
-	;
+	
+	//Interval statistics index, rebuilt on demand after the mutators below invalidate it.
+	//Code that edits depth/conductivity directly must call invalidate_index() afterwards.
+	bool depthascending = false;
+	std::vector<double> cumsum_linear;
+	std::vector<double> cumsum_log10;
+
 	cConductivityLog(){};
 
 	cConductivityLog(const std::string& confile, const bool readheaderonly = false){
@@ -59,14 +70,17 @@ public:
 			return true;
 		}
 
-		//Read data
+		//Read data, parsing the two numbers in place rather than tokenising each line
 		while (filegetline(fp, s)){
-			t = tokenize(s);
-			if (t[0] == "NaN")continue;
-			else if (t[1] == "NaN")continue;
-			double d = std::atof(t[0].c_str());
-			double c = std::atof(t[1].c_str());
-			if (d < 0)continue;
+			const char* p0 = s.c_str();
+			char* p1;
+			char* p2;
+			double d = std::strtod(p0, &p1);
+			if (p1 == p0)continue;
+			double c = std::strtod(p1, &p2);
+			if (p2 == p1)continue;
+			if (std::isnan(d) || std::isnan(c))continue;
+			else if (d < 0)continue;
 			else if (c <= 0)continue;
 			else{
 				depth.push_back(d);
@@ -74,11 +88,54 @@ public:
 			}
 		}
 		fclose(fp);
+		build_index();
 		return true;
 	};
 
+	void set_samples(const std::vector<double>& _depth, const std::vector<double>& _conductivity){
+		depth = _depth;
+		conductivity = _conductivity;
+		invalidate_index();
+	}
+
+	void add_sample(const double& d, const double& c){
+		depth.push_back(d);
+		conductivity.push_back(c);
+		invalidate_index();
+	}
+
+	void invalidate_index(){
+		indexvalid = false;
+	}
+
+	void build_index(){
+		const size_t n = depth.size();
+		depthascending = std::is_sorted(depth.begin(), depth.end());
+		cumsum_linear.resize(n + 1);
+		cumsum_log10.resize(n + 1);
+		cumsum_linear[0] = 0.0;
+		cumsum_log10[0] = 0.0;
+		for (size_t k = 0; k < n; k++){
+			cumsum_linear[k + 1] = cumsum_linear[k] + conductivity[k];
+			cumsum_log10[k + 1] = cumsum_log10[k] + std::log10(conductivity[k]);
+		}
+		indexvalid = true;
+	}
+
+	//The size check also catches samples appended directly without invalidate_index()
+	bool index_isvalid() const {
+		return indexvalid && cumsum_linear.size() == depth.size() + 1;
+	}
+
 	std::pair<size_t, size_t> first_last_index(const double& d1, const double& d2){
 
+		if (index_isvalid() == false) build_index();
+		if (depthascending){
+			auto start = std::lower_bound(depth.begin(), depth.end(), d1);
+			auto end = std::upper_bound(start, depth.end(), d2);
+			return std::pair<size_t, size_t>(start - depth.begin(), end - depth.begin());
+		}
+
 		auto start = std::find_if(
 			depth.begin(), depth.end(),
 			[&d1](const double& item){ return item >= d1; }
@@ -113,16 +170,26 @@ public:
 		const std::pair<size_t, size_t> p = first_last_index(d1, d2);
 		n = p.second - p.first;
 		if (n <= 0)return false;
-		for (size_t k = p.first; k < p.second; k++){
-			linear_mean += conductivity[k];
-			log10_mean += std::log10(conductivity[k]);
-		}
-		linear_mean /= (double)n;
-		log10_mean /= (double)n;
+		linear_mean = (cumsum_linear[p.second] - cumsum_linear[p.first]) / (double)n;
+		log10_mean = (cumsum_log10[p.second] - cumsum_log10[p.first]) / (double)n;
 		log10_mean = std::pow(10.0, log10_mean);
 		return true;
 	};
 
+	//Means over each interval of a layered model given its nlayers+1 boundary depths
+	size_t interval_means(const std::vector<double>& boundaries, std::vector<size_t>& n, std::vector<double>& linear_mean, std::vector<double>& log10_mean){
+
+		const size_t nlayers = boundaries.size() > 0 ? boundaries.size() - 1 : 0;
+		n.resize(nlayers);
+		linear_mean.resize(nlayers);
+		log10_mean.resize(nlayers);
+		size_t nvalid = 0;
+		for (size_t li = 0; li < nlayers; li++){
+			if (interval_means(boundaries[li], boundaries[li + 1], n[li], linear_mean[li], log10_mean[li])) nvalid++;
+		}
+		return nvalid;
+	};
+
 	std::string infostring()
 	{
 		std::string s;
@@ -136,5 +203,161 @@ public:
 	};
 };
 
-#endif
+//Many conductivity logs packed into one contiguous structure-of-arrays arena with a spatial index on (x, y)
+class cConductivityLogCatalogue{
+
+public:
+	std::vector<std::string> name;
+	std::vector<std::string> source;
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> z;
+
+	//Samples of log i are at [offset[i], offset[i+1]) in the arena arrays
+	std::vector<size_t> offset;
+	std::vector<double> depth;
+	std::vector<double> conductivity;
+
+	//Running sums restarted at zero for each log (size nsamples+nlogs), so their precision does not depend on
+	//where the log sits in the arena. Log i's sums are at [offset[i]+i, offset[i+1]+i], see cumsumindex().
+	std::vector<double> cumsum_linear;
+	std::vector<double> cumsum_log10;
+
+	cRadiusSearcher searcher;
+
+	cConductivityLogCatalogue(){
+		offset.push_back(0);
+	};
+
+	cConductivityLogCatalogue(const std::string& directory, const std::string& extension = "con"){
+		load_directory(directory, extension);
+	};
+
+	size_t nlogs() const { return x.size(); }
+
+	size_t nsamples(const size_t li) const { return offset[li + 1] - offset[li]; }
+
+	//Position in the cumsum arrays of the sum of log li's samples before arena sample k
+	size_t cumsumindex(const size_t li, const size_t k) const { return k + li; }
 
+	size_t load_directory(const std::string& directory, const std::string& extension = "con"){
+		std::vector<std::string> files = getfilelist(directory, extension);
+		return load_files(files);
+	}
+
+	size_t load_files(const std::vector<std::string>& files){
+
+		const long nf = (long)files.size();
+		std::vector<cConductivityLog> logs(files.size());
+		#pragma omp parallel for schedule(dynamic,16)
+		for (long i = 0; i < nf; i++){
+			logs[i].load_confile(files[i]);
+		}
+
+		const size_t nl = logs.size();
+		name.resize(nl);
+		source.resize(nl);
+		x.resize(nl);
+		y.resize(nl);
+		z.resize(nl);
+		offset.resize(nl + 1);
+		offset[0] = 0;
+		for (size_t i = 0; i < nl; i++){
+			offset[i + 1] = offset[i] + logs[i].depth.size();
+		}
+
+		const size_t ns = offset[nl];
+		depth.resize(ns);
+		conductivity.resize(ns);
+		cumsum_linear.resize(ns + nl);
+		cumsum_log10.resize(ns + nl);
+
+		const long nli = (long)nl;
+		#pragma omp parallel for schedule(dynamic,16)
+		for (long i = 0; i < nli; i++){
+			cConductivityLog& L = logs[i];
+			name[i] = L.name;
+			source[i] = L.source;
+			x[i] = L.x;
+			y[i] = L.y;
+			z[i] = L.z;
+			std::copy(L.depth.begin(), L.depth.end(), depth.begin() + offset[i]);
+			std::copy(L.conductivity.begin(), L.conductivity.end(), conductivity.begin() + offset[i]);
+
+			size_t c = cumsumindex(i, offset[i]);
+			cumsum_linear[c] = 0.0;
+			cumsum_log10[c] = 0.0;
+			for (size_t k = offset[i]; k < offset[i + 1]; k++, c++){
+				cumsum_linear[c + 1] = cumsum_linear[c] + conductivity[k];
+				cumsum_log10[c + 1] = cumsum_log10[c] + std::log10(conductivity[k]);
+			}
+		}
+		return nl;
+	}
+
+	cConductivityLog log(const size_t li) const {
+		cConductivityLog L;
+		L.name = name[li];
+		L.source = source[li];
+		L.x = x[li];
+		L.y = y[li];
+		L.z = z[li];
+		L.depth.assign(depth.begin() + offset[li], depth.begin() + offset[li + 1]);
+		L.conductivity.assign(conductivity.begin() + offset[li], conductivity.begin() + offset[li + 1]);
+		L.build_index();
+		return L;
+	}
+
+	//Depths within each log must be ascending
+	bool interval_means(const size_t li, const double& d1, const double& d2, size_t& n, double& linear_mean, double& log10_mean) const {
+		auto begin = depth.begin() + offset[li];
+		auto end = depth.begin() + offset[li + 1];
+		const size_t i1 = std::lower_bound(begin, end, d1) - depth.begin();
+		const size_t i2 = std::upper_bound(depth.begin() + i1, end, d2) - depth.begin();
+		n = i2 - i1;
+		linear_mean = 0.0;
+		log10_mean = 0.0;
+		if (n <= 0)return false;
+		const size_t c1 = cumsumindex(li, i1);
+		const size_t c2 = cumsumindex(li, i2);
+		linear_mean = (cumsum_linear[c2] - cumsum_linear[c1]) / (double)n;
+		log10_mean = std::pow(10.0, (cumsum_log10[c2] - cumsum_log10[c1]) / (double)n);
+		return true;
+	}
+
+	void build_spatial_index(const double& radius){
+		searcher = cRadiusSearcher(x, y, z, radius);
+	}
+
+	//Row s lists the logs within radius of sounding (sx[s], sy[s]), values are the horizontal distances
+	cSparseMatrix<double> findlogs(const std::vector<double>& sx, const std::vector<double>& sy, const double& radius){
+
+		const size_t nsoundings = sx.size();
+		cSparseMatrix<double> m(nsoundings, nlogs());
+		if (nlogs() == 0){
+			for (size_t s = 0; s < nsoundings; s++) m.endrow();
+			return m;
+		}
+		if (searcher.x.size() != nlogs() || searcher.radius < radius){
+			build_spatial_index(radius);
+		}
+
+		std::vector<std::vector<size_t>> index(nsoundings);
+		std::vector<std::vector<double>> distance(nsoundings);
+		const long nsi = (long)nsoundings;
+		#pragma omp parallel for schedule(dynamic,64)
+		for (long s = 0; s < nsi; s++){
+			index[s] = searcher.findneighbourstopoint(sx[s], sy[s], distance[s], radius);
+		}
+
+		for (size_t s = 0; s < nsoundings; s++){
+			for (size_t k = 0; k < index[s].size(); k++){
+				m.push(index[s][k], distance[s][k]);
+			}
+			m.endrow();
+		}
+		return m;
+	}
+};
+
+#endif
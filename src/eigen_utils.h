@@ -9,7 +9,10 @@ Author: Ross C. Brodie, Geoscience Australia.
 #ifndef _eigen_utils_H
 #define _eigen_utils_H
 
+#include <iostream>
+#include <fstream>
 #include <vector>
+#include <stdexcept>
 #include <Eigen/Dense>
 typedef Eigen::VectorXd VectorDouble;
 typedef Eigen::MatrixXd MatrixDouble;
@@ -126,11 +129,7 @@ template<typename T>
 Eigen::Matrix<T, -1, 1> get_nrand(size_t n, const T& mean, const T& stddev)
 {
 	Eigen::Matrix<T, -1, 1> x(n);
-	std::mt19937 gen(std::chrono::system_clock::now().time_since_epoch().count());
-	std::normal_distribution<T> dist(mean, stddev);
-	for (size_t i = 0; i < x.rows(); i++) {
-		x[i] = dist(gen);
-	}
+	nrand<T>(n, x.data(), mean, stddev);
 	return x;
 };
 
@@ -148,6 +147,75 @@ std::vector<T> mvnrand_lowercholesky(const Eigen::Matrix<T, -1, -1>& L)
 	return x;
 };
 
+//Multivariate Gaussian N(mean, C) with the Cholesky factor C = LL' and log|C| cached,
+//so repeated sampling and density evaluation cost triangular products and solves only.
+//Batches are matrices with one draw or point per column.
+template<typename T>
+class cMvGaussian{
+
+public:
+	typedef Eigen::Matrix<T, -1, 1> Vector;
+	typedef Eigen::Matrix<T, -1, -1> Matrix;
+
+	Vector mean;
+	Matrix L;
+	T logdet = 0;
+
+	cMvGaussian(){ };
+
+	cMvGaussian(const Vector& _mean, const Matrix& C){
+		setmean(_mean);
+		setcovariance(C);
+	};
+
+	size_t dimension() const { return (size_t)mean.rows(); }
+
+	void setmean(const Vector& _mean){
+		mean = _mean;
+	}
+
+	//C must be symmetric positive definite
+	void setcovariance(const Matrix& C){
+		Eigen::LLT<Matrix> llt(C);
+		if (llt.info() != Eigen::Success){
+			throw(std::runtime_error("cMvGaussian::setcovariance() covariance is not positive definite"));
+		}
+		L = llt.matrixL();
+		logdet = 2.0 * L.diagonal().array().log().sum();
+	}
+
+	Vector sample() const {
+		Vector z = get_nrand<T>(dimension(), 0.0, 1.0);
+		return mean + L.template triangularView<Eigen::Lower>() * z;
+	}
+
+	//n draws as one triangular matrix product
+	Matrix samplebatch(const size_t n) const {
+		Matrix Z(dimension(), n);
+		nrand<T>(Z.size(), Z.data(), 0.0, 1.0);
+		Matrix X = L.template triangularView<Eigen::Lower>() * Z;
+		X.colwise() += mean;
+		return X;
+	}
+
+	T logpdf(const Vector& m) const {
+		Vector y = L.template triangularView<Eigen::Lower>().solve(m - mean);
+		return -0.5 * ((T)dimension() * std::log(TWOPI) + logdet + y.squaredNorm());
+	}
+
+	//Log densities of the columns of M with a single multiple right hand side solve
+	Vector logpdfbatch(const Matrix& M) const {
+		Matrix Y = M.colwise() - mean;
+		L.template triangularView<Eigen::Lower>().solveInPlace(Y);
+		const T c = (T)dimension() * std::log(TWOPI) + logdet;
+		return (-0.5 * (Y.colwise().squaredNorm().array() + c)).matrix().transpose();
+	}
+
+	T pdf(const Vector& m) const {
+		return std::exp(logpdf(m));
+	}
+};
+
 template<typename T>
 std::vector<T> mvnrand_covariance(const Eigen::Matrix<T, -1, -1>& C)
 {
@@ -155,20 +223,12 @@ std::vector<T> mvnrand_covariance(const Eigen::Matrix<T, -1, -1>& C)
 	return mvnrand_lowercholesky(lu.matrixL());
 };
 
+//For repeated evaluations with the same covariance use cMvGaussian
 template<typename T>
 T mvgaussian_pdf(const VectorDouble& m0, const Eigen::Matrix<T, -1, -1>& C, const VectorDouble& m)
 {
-	size_t k = m0.rows();
-	MatrixDouble I = MatrixDouble::Identity(k, k);
-
-	Eigen::FullPivLU<MatrixDouble> lu(C);
-	MatrixDouble invC = lu.solve(I);
-	double detC = lu.determinant();
-
-	VectorDouble dm = m - m0;
-	double a = -0.5 * mtAm(dm, invC);
-	double pdf = exp(a) / sqrt(pow(TWOPI, k) * detC);
-	return pdf;
+	cMvGaussian<T> G(m0, C);
+	return G.pdf(m);
 };
 
 #endif
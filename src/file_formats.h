@@ -9,6 +9,8 @@ Author: Ross C. Brodie, Geoscience Australia.
 #ifndef _file_formats_H
 #define _file_formats_H
 
+#include <cstdio>
+#include <cmath>
 #include <cstring>
 #include <vector>
 #include <fstream>
@@ -137,6 +139,22 @@ public:
 		return s;
 	}
 
+	//Appends a value to a fixed width record, right justified in fmtwidth characters
+	void formatvalue(std::string& record, const double v) const {
+		char buf[64];
+		int n;
+		if (fmttype == 'I' || fmttype == 'i'){
+			n = std::snprintf(buf, sizeof(buf), "%*lld", (int)fmtwidth, (long long)std::llround(v));
+		}
+		else if (fmttype == 'E' || fmttype == 'e'){
+			n = std::snprintf(buf, sizeof(buf), "%*.*le", (int)fmtwidth, (int)fmtdecimals, v);
+		}
+		else{
+			n = std::snprintf(buf, sizeof(buf), "%*.*lf", (int)fmtwidth, (int)fmtdecimals, v);
+		}
+		if (n > 0) record.append(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+	}
+
 	void print(){		
 		printf("\n");
 		printf(" name=%s", name.c_str());
@@ -235,6 +253,26 @@ class cOutputFileInfo{
 		}
 	}
 
+	//Appends the nbands values of field fi to a fixed width record in the order the fields were added
+	void formatfield(std::string& record, const size_t fi, const double* v) const {
+		for (size_t bi = 0; bi < fields[fi].nbands; bi++){
+			fields[fi].formatvalue(record, v[bi]);
+		}
+	}
+
+	void formatfield(std::string& record, const size_t fi, const double v) const {
+		fields[fi].formatvalue(record, v);
+	}
+
+	//Total characters in a fixed width record, excluding the newline
+	size_t recordwidth() const {
+		size_t n = 0;
+		for (size_t i = 0; i < fields.size(); i++){
+			n += fields[i].fmtwidth * fields[i].nbands;
+		}
+		return n;
+	}
+
 	void write_simple_header(const std::string pathname){
 		FILE* fp = fileopen(pathname.c_str(), "w");		
 		for (size_t i = 0; i < fields.size(); i++){
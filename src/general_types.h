@@ -9,7 +9,11 @@ Author: Ross C. Brodie, Geoscience Australia.
 #ifndef _general_types_H
 #define _general_types_H
 
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include <complex>
 #include <vector>
 #include "undefinedvalues.h"
@@ -229,6 +233,346 @@ public:
 	}
 };
 
+//Streaming mean, variance (Welford), extremes and null count. Chunks can be added in any order
+//and partial accumulators from threads or MPI ranks combined with merge() (Chan et al.).
+template<typename T>
+class cRunningStats{
+
+public:
+	size_t nulls = 0;
+	size_t nonnulls = 0;
+	T min = 0;
+	T max = 0;
+	double mean = 0.0;
+	double m2 = 0.0;//sum of squared deviations from the mean
+
+	void reset(){
+		*this = cRunningStats();
+	}
+
+	void add(const T& x){
+		nonnulls++;
+		if (nonnulls == 1){
+			min = x;
+			max = x;
+		}
+		else if (x < min) min = x;
+		else if (x > max) max = x;
+		const double d = (double)x - mean;
+		mean += d / (double)nonnulls;
+		m2 += d * ((double)x - mean);
+	}
+
+	void add(const T* x, const size_t n){
+		for (size_t i = 0; i < n; i++) add(x[i]);
+	}
+
+	void add(const T* x, const size_t n, const T nullvalue){
+		for (size_t i = 0; i < n; i++){
+			if (x[i] == nullvalue) nulls++;
+			else add(x[i]);
+		}
+	}
+
+	void merge(const cRunningStats& b){
+		nulls += b.nulls;
+		if (b.nonnulls == 0) return;
+		if (nonnulls == 0){
+			size_t n = nulls;
+			*this = b;
+			nulls = n;
+			return;
+		}
+		const double na = (double)nonnulls;
+		const double nb = (double)b.nonnulls;
+		const double n = na + nb;
+		const double d = b.mean - mean;
+		mean += d * nb / n;
+		m2 += b.m2 + d * d * na * nb / n;
+		nonnulls += b.nonnulls;
+		if (b.min < min) min = b.min;
+		if (b.max > max) max = b.max;
+	}
+
+	//Sample variance, as cStats
+	double var() const { return nonnulls > 1 ? m2 / ((double)nonnulls - 1.0) : 0.0; }
+
+	double std() const { return std::sqrt(var()); }
+
+	cStats<T> stats() const {
+		cStats<T> s;
+		s.nulls = nulls;
+		s.nonnulls = nonnulls;
+		s.min = min;
+		s.max = max;
+		s.mean = (T)mean;
+		s.var = (T)var();
+		s.std = (T)std();
+		return s;
+	}
+
+	//Flat representation for sending between processes
+	std::vector<double> serialise() const {
+		return { (double)nulls, (double)nonnulls, (double)min, (double)max, mean, m2 };
+	}
+
+	void merge_serialised(const double* p){
+		cRunningStats b;
+		b.nulls = (size_t)p[0];
+		b.nonnulls = (size_t)p[1];
+		b.min = (T)p[2];
+		b.max = (T)p[3];
+		b.mean = p[4];
+		b.m2 = p[5];
+		merge(b);
+	}
+};
+
+//Fixed bin histogram that accumulates chunks, values outside [hmin,hmax] go in the end bins as cHistogram.
+//NaN and infinite values are not binned but counted in nonfinite.
+template<typename T>
+class cStreamingHistogram{
+
+public:
+	T hmin = 0;
+	T hmax = 1;
+	std::vector<size_t> count;
+	size_t nonfinite = 0;
+
+	cStreamingHistogram(){ };
+
+	cStreamingHistogram(const T _hmin, const T _hmax, const size_t nbins){
+		hmin = _hmin;
+		hmax = _hmax;
+		count.assign(nbins, 0);
+	}
+
+	size_t nbins() const { return count.size(); }
+
+	//Zero the counts but keep the bins
+	void reset(){
+		count.assign(nbins(), 0);
+		nonfinite = 0;
+	}
+
+	std::vector<T> centres() const {
+		std::vector<T> c(nbins());
+		const double dx = (double)(hmax - hmin) / (double)nbins();
+		for (size_t i = 0; i < nbins(); i++) c[i] = (T)((double)hmin + dx * ((double)i + 0.5));
+		return c;
+	}
+
+	void add(const T& x){
+		if (std::isfinite(x) == false){
+			nonfinite++;
+			return;
+		}
+		const size_t nb = nbins();
+		if (x <= hmin) count[0]++;
+		else if (x >= hmax) count[nb - 1]++;
+		else{
+			//In double so integral T is not binned by integer division
+			size_t b = (size_t)((double)(x - hmin) / (double)(hmax - hmin) * (double)nb);
+			if (b >= nb) b = nb - 1;
+			count[b]++;
+		}
+	}
+
+	void add(const T* x, const size_t n){
+		for (size_t i = 0; i < n; i++) add(x[i]);
+	}
+
+	//Both histograms must have the same bins
+	void merge(const cStreamingHistogram& b){
+		for (size_t i = 0; i < nbins(); i++) count[i] += b.count[i];
+		nonfinite += b.nonfinite;
+	}
+
+	cHistogramStats<T> stats() const {
+		return cHistogramStats<T>(centres(), count.data());
+	}
+
+	//[counts..., nonfinite]
+	std::vector<double> serialise() const {
+		std::vector<double> s(count.begin(), count.end());
+		s.push_back((double)nonfinite);
+		return s;
+	}
+
+	void merge_serialised(const double* p){
+		for (size_t i = 0; i < nbins(); i++) count[i] += (size_t)p[i];
+		nonfinite += (size_t)p[nbins()];
+	}
+};
+
+//KLL quantile sketch (Karnin, Lang and Liberty 2016). Stores O(k log(n/k)) values, rank error about 1.7/k
+//with high probability, and merging sketches gives the same guarantees as one sketch over all the data.
+//Level h holds values each standing for 2^h samples; a full level is sorted and every other value promoted.
+template<typename T>
+class cQuantileSketch{
+
+private:
+	std::vector<std::vector<T>> levels;
+	size_t size = 0;
+	size_t maxsize = 0;
+	uint64_t randomstate = 0x9E3779B97F4A7C15ULL;
+
+	size_t capacity(const size_t h) const {
+		const size_t depth = levels.size() - h - 1;
+		return (size_t)std::ceil(std::pow(2.0 / 3.0, (double)depth) * (double)k) + 1;
+	}
+
+	void grow(){
+		levels.push_back(std::vector<T>());
+		maxsize = 0;
+		for (size_t h = 0; h < levels.size(); h++) maxsize += capacity(h);
+	}
+
+	bool randombit(){
+		randomstate ^= randomstate << 13;
+		randomstate ^= randomstate >> 7;
+		randomstate ^= randomstate << 17;
+		return (randomstate >> 32) & 1;
+	}
+
+	void compress(){
+		for (size_t h = 0; h < levels.size(); h++){
+			if (levels[h].size() >= capacity(h)){
+				if (h + 1 >= levels.size()) grow();
+				std::vector<T>& a = levels[h];
+				std::vector<T>& b = levels[h + 1];
+				std::sort(a.begin(), a.end());
+				//Odd count leaves the smallest value behind
+				const size_t start = a.size() % 2;
+				const size_t offset = randombit() ? 1 : 0;
+				for (size_t i = start + offset; i < a.size(); i += 2) b.push_back(a[i]);
+				a.resize(start);
+				size = 0;
+				for (size_t j = 0; j < levels.size(); j++) size += levels[j].size();
+				return;
+			}
+		}
+	}
+
+	std::vector<std::pair<T, uint64_t>> weighted() const {
+		std::vector<std::pair<T, uint64_t>> w;
+		w.reserve(size);
+		for (size_t h = 0; h < levels.size(); h++){
+			for (size_t i = 0; i < levels[h].size(); i++){
+				w.push_back(std::make_pair(levels[h][i], (uint64_t)1 << h));
+			}
+		}
+		std::sort(w.begin(), w.end());
+		return w;
+	}
+
+public:
+	size_t k = 200;
+	uint64_t n = 0;//samples seen
+
+	cQuantileSketch(const size_t _k = 200){
+		k = _k;
+		grow();
+	}
+
+	//Empty the sketch but keep k
+	void reset(){
+		levels.clear();
+		size = 0;
+		n = 0;
+		randomstate = 0x9E3779B97F4A7C15ULL;
+		grow();
+	}
+
+	//NaN is skipped, it has no rank and would break the sort in compress()
+	void add(const T& x){
+		if (std::isnan(x)) return;
+		levels[0].push_back(x);
+		size++;
+		n++;
+		if (size >= maxsize) compress();
+	}
+
+	void add(const T* x, const size_t count){
+		for (size_t i = 0; i < count; i++) add(x[i]);
+	}
+
+	void merge(const cQuantileSketch& b){
+		while (levels.size() < b.levels.size()) grow();
+		for (size_t h = 0; h < b.levels.size(); h++){
+			levels[h].insert(levels[h].end(), b.levels[h].begin(), b.levels[h].end());
+		}
+		n += b.n;
+		size = 0;
+		for (size_t h = 0; h < levels.size(); h++) size += levels[h].size();
+		while (size >= maxsize) compress();
+	}
+
+	//Number of values retained
+	size_t retained() const { return size; }
+
+	//Approximate q quantile, 0 <= q <= 1
+	T quantile(const double q) const {
+		const std::vector<std::pair<T, uint64_t>> w = weighted();
+		if (w.size() == 0) return 0;
+		uint64_t total = 0;
+		for (size_t i = 0; i < w.size(); i++) total += w[i].second;
+		const double target = q * (double)total;
+		uint64_t cum = 0;
+		for (size_t i = 0; i < w.size(); i++){
+			cum += w[i].second;
+			if ((double)cum >= target) return w[i].first;
+		}
+		return w.back().first;
+	}
+
+	std::vector<T> quantiles(const std::vector<double>& q) const {
+		std::vector<T> v(q.size());
+		for (size_t i = 0; i < q.size(); i++) v[i] = quantile(q[i]);
+		return v;
+	}
+
+	//Approximate fraction of samples <= x
+	double rank(const T& x) const {
+		uint64_t below = 0, total = 0;
+		for (size_t h = 0; h < levels.size(); h++){
+			for (size_t i = 0; i < levels[h].size(); i++){
+				if (levels[h][i] <= x) below += (uint64_t)1 << h;
+			}
+			total += (uint64_t)levels[h].size() << h;
+		}
+		return total > 0 ? (double)below / (double)total : 0.0;
+	}
+
+	//[k, n, nlevels, level sizes..., values...]
+	std::vector<double> serialise() const {
+		std::vector<double> s;
+		s.reserve(3 + levels.size() + size);
+		s.push_back((double)k);
+		s.push_back((double)n);
+		s.push_back((double)levels.size());
+		for (size_t h = 0; h < levels.size(); h++) s.push_back((double)levels[h].size());
+		for (size_t h = 0; h < levels.size(); h++){
+			s.insert(s.end(), levels[h].begin(), levels[h].end());
+		}
+		return s;
+	}
+
+	void merge_serialised(const double* p){
+		cQuantileSketch b((size_t)p[0]);
+		b.n = (uint64_t)p[1];
+		const size_t nl = (size_t)p[2];
+		const double* v = p + 3 + nl;
+		while (b.levels.size() < nl) b.grow();
+		for (size_t h = 0; h < nl; h++){
+			const size_t m = (size_t)p[3 + h];
+			b.levels[h].assign(v, v + m);
+			v += m;
+		}
+		merge(b);
+	}
+};
+
 template<typename T>
 class cRange{
 
@@ -281,6 +625,39 @@ public:
 
 };
 
+//Non-owning view of a contiguous array, like C++20 std::span
+template <typename T>
+class cSpan{
+
+	T* p = nullptr;
+	size_t n = 0;
+
+public:
+
+	cSpan(){ };
+
+	cSpan(T* _p, const size_t _n){
+		p = _p;
+		n = _n;
+	}
+
+	cSpan(std::vector<T>& v){
+		p = v.data();
+		n = v.size();
+	}
+
+	T* data() const { return p; }
+	size_t size() const { return n; }
+	bool empty() const { return n == 0; }
+	T* begin() const { return p; }
+	T* end() const { return p + n; }
+	T& operator[](const size_t i) const { return p[i]; }
+
+	cSpan subspan(const size_t offset, const size_t count) const {
+		return cSpan(p + offset, count);
+	}
+};
+
 template <typename T>
 class c3DArray{
 
@@ -323,5 +700,153 @@ public:
 	int nk() const { return (int) data[0][0].size(); }
 };
 
+//Compressed sparse row (CSR) matrix, typically used as a precomputed linear operator
+template <typename T>
+class cSparseMatrix{
+
+public:
+
+	class cTriplet{
+	public:
+		size_t r;
+		size_t c;
+		T v;
+		cTriplet(const size_t _r, const size_t _c, const T& _v) : r(_r), c(_c), v(_v) {};
+		std::ptrdiff_t row() const { return (std::ptrdiff_t)r; }
+		std::ptrdiff_t col() const { return (std::ptrdiff_t)c; }
+		const T& value() const { return v; }
+	};
+
+	size_t nrows = 0;
+	size_t ncols = 0;
+	std::vector<size_t> rowptr;
+	std::vector<size_t> colindex;
+	std::vector<T> value;
+
+	cSparseMatrix(){
+		rowptr.push_back(0);
+	};
+
+	cSparseMatrix(const size_t _nrows, const size_t _ncols, const size_t nnzestimate = 0){
+		initialise(_nrows, _ncols, nnzestimate);
+	};
+
+	void initialise(const size_t _nrows, const size_t _ncols, const size_t nnzestimate = 0){
+		nrows = _nrows;
+		ncols = _ncols;
+		rowptr.clear();
+		rowptr.reserve(nrows + 1);
+		rowptr.push_back(0);
+		colindex.clear();
+		value.clear();
+		colindex.reserve(nnzestimate);
+		value.reserve(nnzestimate);
+	}
+
+	//Rows must be built in order: push the entries of a row then call endrow()
+	void push(const size_t col, const T& v){
+		colindex.push_back(col);
+		value.push_back(v);
+	}
+
+	void endrow(){
+		rowptr.push_back(colindex.size());
+	}
+
+	size_t nnz() const { return value.size(); }
+
+	//y = A*x
+	void multiply(const T* x, T* y) const
+	{
+		const size_t* cp = colindex.data();
+		const T* vp = value.data();
+		for (size_t i = 0; i < nrows; i++){
+			T s = 0;
+			for (size_t k = rowptr[i]; k < rowptr[i + 1]; k++){
+				s += vp[k] * x[cp[k]];
+			}
+			y[i] = s;
+		}
+	}
+
+	std::vector<T> multiply(const std::vector<T>& x) const
+	{
+		std::vector<T> y(nrows);
+		multiply(x.data(), y.data());
+		return y;
+	}
+
+	//Y = A*X for nv vectors at once, X (ncols x nv) and Y (nrows x nv) are stored row by row
+	//so that the innermost loop runs over contiguous memory and vectorises
+	void multiply(const size_t nv, const T* x, T* y) const
+	{
+		const size_t* cp = colindex.data();
+		const T* vp = value.data();
+		for (size_t i = 0; i < nrows; i++){
+			T* yrow = y + i*nv;
+			for (size_t j = 0; j < nv; j++) yrow[j] = 0;
+			for (size_t k = rowptr[i]; k < rowptr[i + 1]; k++){
+				const T w = vp[k];
+				const T* xrow = x + cp[k]*nv;
+				for (size_t j = 0; j < nv; j++){
+					yrow[j] += w * xrow[j];
+				}
+			}
+		}
+	}
+
+	//y = A'*x
+	void transposemultiply(const T* x, T* y) const
+	{
+		for (size_t j = 0; j < ncols; j++) y[j] = 0;
+		for (size_t i = 0; i < nrows; i++){
+			const T xi = x[i];
+			for (size_t k = rowptr[i]; k < rowptr[i + 1]; k++){
+				y[colindex[k]] += value[k] * xi;
+			}
+		}
+	}
+
+	std::vector<T> transposemultiply(const std::vector<T>& x) const
+	{
+		std::vector<T> y(ncols);
+		transposemultiply(x.data(), y.data());
+		return y;
+	}
+
+	std::vector<std::vector<T>> dense() const
+	{
+		std::vector<std::vector<T>> a(nrows, std::vector<T>(ncols, 0));
+		for (size_t i = 0; i < nrows; i++){
+			for (size_t k = rowptr[i]; k < rowptr[i + 1]; k++){
+				a[i][colindex[k]] = value[k];
+			}
+		}
+		return a;
+	}
+
+	std::vector<cTriplet> triplets() const
+	{
+		std::vector<cTriplet> t;
+		t.reserve(nnz());
+		for (size_t i = 0; i < nrows; i++){
+			for (size_t k = rowptr[i]; k < rowptr[i + 1]; k++){
+				t.push_back(cTriplet(i, colindex[k], value[k]));
+			}
+		}
+		return t;
+	}
+
+	//Export to any sparse matrix type with a (rows,cols) constructor and setFromTriplets(), e.g. Eigen::SparseMatrix<double>
+	template<typename SparseMatrixType>
+	SparseMatrixType sparsematrix() const
+	{
+		std::vector<cTriplet> t = triplets();
+		SparseMatrixType A(nrows, ncols);
+		A.setFromTriplets(t.begin(), t.end());
+		return A;
+	}
+};
+
 
 #endif
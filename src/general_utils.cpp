@@ -13,6 +13,7 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <sys/timeb.h>
 #include <iterator>
 #include <sstream>
+#include <stdexcept>
 
 #if defined _WIN32
 	#define NOMINMAX 
@@ -41,6 +42,7 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include "general_utils.h"
 #include "file_utils.h"
 #include "string_utils.h"
+#include "memusage.h"
 
 std::string commandlinestring(int argc, char** argv){
 	std::string str = "Executing:";
@@ -524,6 +526,23 @@ std::vector<double> linearinterp(const std::vector<double>& x, const std::vector
 	return yi;
 }
 
+cSparseMatrix<double> linearinterpoperator(const std::vector<double>& x, const std::vector<double>& xi)
+{
+	//Operator R such that R*y == linearinterp(x, y, xi) for any y defined at x
+	const size_t n = x.size();
+	cSparseMatrix<double> R(xi.size(), n, 2 * xi.size());
+	for (size_t i = 0; i < xi.size(); i++){
+		int k = findindex(n, x.data(), xi[i]);
+		if (k < 0)k = 0;
+		else if (k >= (int)(n)-1)k = (int)(n)-2;
+		const double t = (xi[i] - x[k]) / (x[k + 1] - x[k]);
+		R.push(k, 1.0 - t);
+		R.push(k + 1, t);
+		R.endrow();
+	}
+	return R;
+}
+
 size_t bytesallocated(const std::vector<int>& v)
 {
 	return v.capacity()*sizeof(int);
@@ -593,22 +612,18 @@ std::vector<double> fractionaloverlaps(const double& a1, const double& a2, const
 	return o;
 }
 
-std::vector<std::vector<double>> overlaps(const std::vector<double>& a, const std::vector<double>& b)
+static bool isascending(const std::vector<double>& v)
 {
-	std::vector<std::vector<double>> o(a.size() - 1);
-	for(size_t ai = 0; ai < a.size()-1; ai++){
-		o[ai].resize(b.size() - 1);
-		for (size_t bi = 0; bi < b.size()-1; bi++){
-			o[ai][bi] = overlap(a[ai], a[ai + 1], b[bi], b[bi + 1]);
-		}	
+	for (size_t i = 1; i < v.size(); i++){
+		if (v[i] < v[i - 1]) return false;
 	}
-	return o;
+	return true;
 }
-std::vector<std::vector<double>> fractionaloverlaps(const std::vector<double>& a, const std::vector<double>& b)
+
+static std::vector<std::vector<double>> bruteforceoverlaps(const std::vector<double>& a, const std::vector<double>& b)
 {
-	std::vector<std::vector<double>> o(a.size() - 1);
+	std::vector<std::vector<double>> o(a.size() - 1, std::vector<double>(b.size() - 1));
 	for (size_t ai = 0; ai < a.size() - 1; ai++){
-		o[ai].resize(b.size() - 1);
 		for (size_t bi = 0; bi < b.size() - 1; bi++){
 			o[ai][bi] = overlap(a[ai], a[ai + 1], b[bi], b[bi + 1]);
 		}
@@ -616,6 +631,53 @@ std::vector<std::vector<double>> fractionaloverlaps(const std::vector<double>& a
 	return o;
 }
 
+std::vector<std::vector<double>> overlaps(const std::vector<double>& a, const std::vector<double>& b)
+{
+	//Use the sweep when it applies, otherwise fall back to the order-agnostic double loop
+	if (isascending(a) && isascending(b)) return sparseoverlaps(a, b).dense();
+	return bruteforceoverlaps(a, b);
+}
+
+std::vector<std::vector<double>> fractionaloverlaps(const std::vector<double>& a, const std::vector<double>& b)
+{
+	//Historically returns the absolute overlaps, use sparsefractionaloverlaps() for fractions
+	return overlaps(a, b);
+}
+
+cSparseMatrix<double> sparseoverlaps(const std::vector<double>& a, const std::vector<double>& b, const bool fractional)
+{
+	//Sweep-line over the ascending boundaries of a and b, O(na + nb + nnz)
+	//The first b layer that can overlap a[ai] never moves backwards as ai increases
+	if (isascending(a) == false || isascending(b) == false){
+		throw(std::runtime_error("sparseoverlaps: layer boundaries must be in ascending order"));
+	}
+	const size_t na = a.size() - 1;
+	const size_t nb = b.size() - 1;
+	cSparseMatrix<double> o(na, nb, na + nb);
+	size_t bstart = 0;
+	for (size_t ai = 0; ai < na; ai++){
+		while (bstart < nb && b[bstart + 1] <= a[ai]) bstart++;
+		const double t = a[ai + 1] - a[ai];
+		for (size_t bi = bstart; bi < nb && b[bi] < a[ai + 1]; bi++){
+			const double v = overlap(a[ai], a[ai + 1], b[bi], b[bi + 1]);
+			if (v > 0.0) o.push(bi, fractional ? v / t : v);
+		}
+		o.endrow();
+	}
+	return o;
+}
+
+cSparseMatrix<double> sparsefractionaloverlaps(const std::vector<double>& a, const std::vector<double>& b)
+{
+	return sparseoverlaps(a, b, true);
+}
+
+cSparseMatrix<double> fractionaloverlapsoperator(const std::vector<double>& a, const std::vector<double>& b)
+{
+	//Operator R such that (R*y)[i] is the overlap-weighted average over layer a[i]-a[i+1] of y defined on the layers of b
+	return sparsefractionaloverlaps(a, b);
+}
+
 double gettime(){
 	struct timeb t;
 	ftime(&t);
@@ -734,19 +796,13 @@ double percentmemoryused()
 #else
 double percentmemoryused()
 {	
-	int pid = getpid();	
-	double vsize,pcpu,pmem;	
-	std::string tmpfile = strprint("ps.%d.tmp",pid);
-	std::string cmd = strprint("ps --pid %d --format pcpu,vsize,pmem > %s\n",pid,tmpfile.c_str());
-	system(cmd.c_str());
-	FILE* fp=fileopen(tmpfile.c_str(),"r");
-	char buf[201];
-	fgets(buf,200,fp);
-	fgets(buf,200,fp);
-	sscanf(buf,"%lf %lf %lf",&pcpu,&vsize,&pmem);
-	fclose(fp);
-	deletefile(tmpfile.c_str());	
-	return pmem;
+	//Resident memory as a percentage of physical memory, from /proc rather than spawning ps
+	cMemoryStatus m(false);
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pagesize = sysconf(_SC_PAGE_SIZE);
+	if (pages <= 0 || pagesize <= 0) return 0.0;
+	double totalkb = (double)pages * (double)pagesize / 1024.0;
+	return 100.0 * (double)m.rss / totalkb;
 }
 #endif
 
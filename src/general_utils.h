@@ -156,6 +156,7 @@ double linearinterp(const std::vector<double>& x, const std::vector<double>& y,
 double linearinterp(const size_t n, const double* x, const double* y, const double& xtarget);
 void   linearinterp(const size_t n, const double* x, const double* y, size_t ni, const double* xi, double* yi);
 std::vector<double> linearinterp(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& xi);
+cSparseMatrix<double> linearinterpoperator(const std::vector<double>& x, const std::vector<double>& xi);
 
 bool isreportable(int rec);
 bool isinrange(const cRange<int>& r, const int& i);
@@ -166,8 +167,13 @@ double fractionaloverlap(const double al, const double ah, const double bl, cons
 std::vector<double> overlaps(const double& a1, const double& a2, const std::vector<double>& b);
 std::vector<double> fractionaloverlaps(const double& a1, const double& a2, const std::vector<double>& b);
 
+//Dense overlaps accept boundaries in any order; fractionaloverlaps returns absolute overlaps (legacy behaviour)
 std::vector<std::vector<double>> overlaps(const std::vector<double>& a, const std::vector<double>& b);
 std::vector<std::vector<double>> fractionaloverlaps(const std::vector<double>& a, const std::vector<double>& b);
+//Sparse overlaps require ascending boundaries in both a and b and throw std::runtime_error otherwise
+cSparseMatrix<double> sparseoverlaps(const std::vector<double>& a, const std::vector<double>& b, const bool fractional = false);
+cSparseMatrix<double> sparsefractionaloverlaps(const std::vector<double>& a, const std::vector<double>& b);
+cSparseMatrix<double> fractionaloverlapsoperator(const std::vector<double>& a, const std::vector<double>& b);
 
 double gettime();
 
@@ -421,5 +421,264 @@ public:
 	}
 };
 
-#endif
+//Axis aligned bounding box
+class cBoundingBox{
+
+public:
+	double xmin, xmax;
+	double ymin, ymax;
+	double zmin, zmax;
+
+	cBoundingBox(){
+		xmin = ymin = zmin = DBL_MAX;
+		xmax = ymax = zmax = -DBL_MAX;
+	}
+
+	bool empty() const { return xmin > xmax; }
+
+	void add(const double& x, const double& y, const double& z){
+		if (x < xmin) xmin = x;
+		if (x > xmax) xmax = x;
+		if (y < ymin) ymin = y;
+		if (y > ymax) ymax = y;
+		if (z < zmin) zmin = z;
+		if (z > zmax) zmax = z;
+	}
+
+	void add(const cBoundingBox& b){
+		if (b.empty()) return;
+		add(b.xmin, b.ymin, b.zmin);
+		add(b.xmax, b.ymax, b.zmax);
+	}
+
+	void expand(const double& d){
+		xmin -= d; ymin -= d; zmin -= d;
+		xmax += d; ymax += d; zmax += d;
+	}
+
+	bool contains(const cPnt& p) const {
+		return p.x >= xmin && p.x <= xmax && p.y >= ymin && p.y <= ymax && p.z >= zmin && p.z <= zmax;
+	}
+
+	//Squared distance from p to the nearest point of the box, 0 if p is inside
+	double distance2(const cPnt& p) const {
+		const double dx = p.x < xmin ? xmin - p.x : (p.x > xmax ? p.x - xmax : 0.0);
+		const double dy = p.y < ymin ? ymin - p.y : (p.y > ymax ? p.y - ymax : 0.0);
+		const double dz = p.z < zmin ? zmin - p.z : (p.z > zmax ? p.z - zmax : 0.0);
+		return dx*dx + dy*dy + dz*dz;
+	}
+};
+
+//Non owning structure of arrays view of n points, e.g. the X and Y fields of a line of survey data.
+//z may be NULL in which case all the points have z = 0.
+//The kernels are plain loops over independent points with no branches or calls so the compiler vectorises them.
+//Distance filters compare squared distances to avoid the sqrt, and are done in blocks so the squared distances
+//stay in cache while the matching indices are gathered.
+class cPntArray{
+
+	static const size_t BLOCK = 256;
+	static const size_t LANES = 8;
+
+	//max(t,0) then min(t,1) without comparisons, which the compiler will not if-convert under the default -ftrapping-math.
+	//Exact for t <= 2, beyond that to within rounding.
+	static double clamp01(const double t){
+		const double a = 0.5 * (t + std::fabs(t));
+		return a - 0.5 * ((a - 1.0) + std::fabs(a - 1.0));
+	}
+
+	//Range of v with LANES independent running minima and maxima, so there is no serial dependency between elements
+	static void range(const double* v, const size_t m, double& lo, double& hi){
+		double l[LANES], h[LANES];
+		for (size_t j = 0; j < LANES; j++) l[j] = h[j] = v[0];
+		size_t i = 0;
+		for (; i + LANES <= m; i += LANES){
+			for (size_t j = 0; j < LANES; j++){
+				l[j] = v[i+j] < l[j] ? v[i+j] : l[j];
+				h[j] = v[i+j] > h[j] ? v[i+j] : h[j];
+			}
+		}
+		for (; i < m; i++){
+			l[0] = v[i] < l[0] ? v[i] : l[0];
+			h[0] = v[i] > h[0] ? v[i] : h[0];
+		}
+		lo = l[0]; hi = h[0];
+		for (size_t j = 1; j < LANES; j++){
+			lo = l[j] < lo ? l[j] : lo;
+			hi = h[j] > hi ? h[j] : hi;
+		}
+	}
+
+	//Squared distances from p to points [i0,i0+m)
+	void distances2(const cPnt& p, const size_t i0, const size_t m, double* d2) const {
+		const double* X = x + i0;
+		const double* Y = y + i0;
+		if (z){
+			const double* Z = z + i0;
+			for (size_t i = 0; i < m; i++){
+				const double dx = X[i] - p.x;
+				const double dy = Y[i] - p.y;
+				const double dz = Z[i] - p.z;
+				d2[i] = dx*dx + dy*dy + dz*dz;
+			}
+		}
+		else{
+			const double pz2 = p.z * p.z;
+			for (size_t i = 0; i < m; i++){
+				const double dx = X[i] - p.x;
+				const double dy = Y[i] - p.y;
+				d2[i] = dx*dx + dy*dy + pz2;
+			}
+		}
+	}
+
+public:
+	const double* x = NULL;
+	const double* y = NULL;
+	const double* z = NULL;
+	size_t n = 0;
+
+	cPntArray(){ };
+
+	cPntArray(const double* _x, const double* _y, const double* _z, const size_t _n){
+		x = _x; y = _y; z = _z; n = _n;
+	}
+
+	cPntArray(const std::vector<double>& _x, const std::vector<double>& _y){
+		x = _x.data(); y = _y.data(); z = NULL; n = _x.size();
+	}
+
+	cPntArray(const std::vector<double>& _x, const std::vector<double>& _y, const std::vector<double>& _z){
+		x = _x.data(); y = _y.data(); z = _z.data(); n = _x.size();
+	}
+
+	size_t size() const { return n; }
+
+	cPnt point(const size_t i) const {
+		return cPnt(x[i], y[i], z ? z[i] : 0.0);
+	}
+
+	cBoundingBox boundingbox() const {
+		cBoundingBox b;
+		if (n == 0) return b;
+		range(x, n, b.xmin, b.xmax);
+		range(y, n, b.ymin, b.ymax);
+		if (z) range(z, n, b.zmin, b.zmax);
+		else b.zmin = b.zmax = 0.0;
+		return b;
+	}
+
+	//Squared distances from p to every point, d2 has n elements
+	void distances2(const cPnt& p, double* d2) const {
+		distances2(p, 0, n, d2);
+	}
+
+	//Squared distances from every point to the closest point on segment s, d2 has n elements
+	void distances2(const cLineSeg& s, double* d2) const {
+		const cPnt P = s.p();
+		const double ux = s.q().x - P.x;
+		const double uy = s.q().y - P.y;
+		const double uz = s.q().z - P.z;
+		const double uu = ux*ux + uy*uy + uz*uz;
+		const double rinv = uu > 0.0 ? 1.0 / uu : 0.0;
+		const double zeros[BLOCK] = { };
+		for (size_t i0 = 0; i0 < n; i0 += BLOCK){
+			const size_t m = n - i0 < BLOCK ? n - i0 : BLOCK;
+			const double* X = x + i0;
+			const double* Y = y + i0;
+			const double* Z = z ? z + i0 : zeros;
+			double* D = d2 + i0;
+			for (size_t i = 0; i < m; i++){
+				const double wx = X[i] - P.x;
+				const double wy = Y[i] - P.y;
+				const double wz = Z[i] - P.z;
+				const double t = clamp01((wx*ux + wy*uy + wz*uz) * rinv);
+				const double dx = wx - t*ux;
+				const double dy = wy - t*uy;
+				const double dz = wz - t*uz;
+				D[i] = dx*dx + dy*dy + dz*dz;
+			}
+		}
+	}
 
+	//Indices of the points within distance r of p, in ascending order. Returns how many.
+	size_t withindistance(const cPnt& p, const double r, std::vector<size_t>& index) const {
+		index.clear();
+		const double r2 = r * r;
+		double d2[BLOCK];
+		for (size_t i0 = 0; i0 < n; i0 += BLOCK){
+			const size_t m = n - i0 < BLOCK ? n - i0 : BLOCK;
+			distances2(p, i0, m, d2);
+			for (size_t i = 0; i < m; i++){
+				if (d2[i] <= r2) index.push_back(i0 + i);
+			}
+		}
+		return index.size();
+	}
+
+	//Index of the point nearest p (the first if there are ties) and its distance
+	size_t nearest(const cPnt& p, double& distance) const {
+		size_t k = 0;
+		double dmin = DBL_MAX;
+		double d2[BLOCK];
+		for (size_t i0 = 0; i0 < n; i0 += BLOCK){
+			const size_t m = n - i0 < BLOCK ? n - i0 : BLOCK;
+			distances2(p, i0, m, d2);
+			for (size_t i = 0; i < m; i++){
+				if (d2[i] < dmin){
+					dmin = d2[i];
+					k = i0 + i;
+				}
+			}
+		}
+		distance = std::sqrt(dmin);
+		return k;
+	}
+
+	//Treating the points as the vertices of a polyline, the closest point c to p and the segment it is on
+	//(segment i joins points i and i+1). Returns the distance from p to c.
+	double closestpoint(const cPnt& p, cPnt& c, size_t& segment) const {
+		segment = 0;
+		if (n < 2){
+			if (n == 1) c = point(0);
+			return n == 1 ? c.distance(p) : DBL_MAX;
+		}
+		const size_t ns = n - 1;
+		double dmin = DBL_MAX, tmin = 0.0;
+		double d2[BLOCK], tb[BLOCK];
+		const double zeros[BLOCK + 1] = { };
+		for (size_t i0 = 0; i0 < ns; i0 += BLOCK){
+			const size_t m = ns - i0 < BLOCK ? ns - i0 : BLOCK;
+			const double* X = x + i0;
+			const double* Y = y + i0;
+			const double* Z = z ? z + i0 : zeros;
+			for (size_t i = 0; i < m; i++){
+				const double ux = X[i+1] - X[i];
+				const double uy = Y[i+1] - Y[i];
+				const double uz = Z[i+1] - Z[i];
+				const double wx = p.x - X[i];
+				const double wy = p.y - Y[i];
+				const double wz = p.z - Z[i];
+				const double uu = ux*ux + uy*uy + uz*uz;
+				const double t = clamp01((wx*ux + wy*uy + wz*uz) / (uu + DBL_MIN));//t = 0 for a zero length segment
+				const double dx = wx - t*ux;
+				const double dy = wy - t*uy;
+				const double dz = wz - t*uz;
+				d2[i] = dx*dx + dy*dy + dz*dz;
+				tb[i] = t;
+			}
+			for (size_t i = 0; i < m; i++){
+				if (d2[i] < dmin){
+					dmin = d2[i];
+					tmin = tb[i];
+					segment = i0 + i;
+				}
+			}
+		}
+		const cPnt a = point(segment);
+		const cPnt b = point(segment + 1);
+		c = cPnt(a.x + tmin*(b.x - a.x), a.y + tmin*(b.y - a.y), a.z + tmin*(b.z - a.z));
+		return std::sqrt(dmin);
+	}
+};
+
+#endif
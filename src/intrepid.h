@@ -13,6 +13,7 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <cmath>
 #include <cfloat>
 #include <climits>
+#include <cstring>
 #include <vector>
 #include <list>
 
@@ -410,6 +411,12 @@ public:
 		swap_endian((int32_t*)&s[221], 1);
 	};
 	static size_t nbytes() { return 512; }
+
+	//32 bit header words straddle two of the 16 bit words
+	static void setint32(int16_t* hdata, const size_t i, const size_t v) {
+		int32_t w = (int32_t)v;
+		std::memcpy(&hdata[i], &w, sizeof(w));
+	}
 };
 
 class ILSegment{
@@ -625,6 +632,37 @@ public:
 		}
 	}
 
+	//Copies v into band of the buffer, call createbuffer() first and writebuffer() after
+	template <typename T>
+	bool setband(const std::vector<T>& v, size_t band = 0)
+	{
+		size_t ns = nsamples();
+		if (isgroupbyline()) ns = 1;
+		if (v.size() < ns) {
+			std::printf("ILSegment::setband() Not enough values");
+			return false;
+		}
+
+		switch (getTypeId()){
+			case IDataType::ID::FLOAT:
+				for (size_t i = 0; i < ns; i++) fdata(i, band) = (float)v[i];
+				return true;
+			case IDataType::ID::DOUBLE:
+				for (size_t i = 0; i < ns; i++) ddata(i, band) = (double)v[i];
+				return true;
+			case IDataType::ID::SHORT:
+				for (size_t i = 0; i < ns; i++) sdata(i, band) = (int16_t)v[i];
+				return true;
+			case IDataType::ID::INT:
+				for (size_t i = 0; i < ns; i++) idata(i, band) = (int32_t)v[i];
+				return true;
+			case IDataType::ID::UBYTE:
+				for (size_t i = 0; i < ns; i++) ubdata(i, band) = (uint8_t)v[i];
+				return true;
+			default: std::printf("ILSegment::setband() Unsupported type"); return false;
+		}
+	}
+
 	size_t nstored(){
 		if (isindexed())return nsamples();
 		else return 1;
@@ -693,6 +731,7 @@ private:
 	ILDataset& Dataset;
 	IHeader Header;	
 	FILE* pFile = (FILE*)NULL;
+	bool writable = false;
 	std::string Name;
 
 public:	
@@ -771,12 +810,26 @@ public:
 		return true;
 	}	
 	
+	//Reopens the data file for update so that segments can be written
+	bool openforwrite()
+	{
+		if (pFile != (FILE*)NULL && writable) return true;
+		close();
+		if ((pFile = fileopen(datafilepath(), "r+b")) == NULL) {
+			glog.logmsg("ILField::openforwrite() cannot open file: %s\n\n", datafilepath().c_str());
+			return false;
+		}
+		writable = true;
+		return true;
+	}
+
 	void close()
 	{
 		if (pFile){
 			fclose(pFile);
 		}
 		pFile = (FILE*)NULL;
+		writable = false;
 	}
 	
 	bool erase()
@@ -861,6 +914,23 @@ public:
 		}
 		return false;
 	}
+
+	//Minimal .PD.vec holding the coordinate space, so new fields read back like Intrepid's own
+	bool write_datum_projection() const
+	{
+		FILE* fp = fileopen(dotvecfilepath(), "w");
+		if (fp == NULL) {
+			glog.logmsg("Cannot create file: %s\n\n", dotvecfilepath().c_str());
+			return false;
+		}
+		fprintf(fp, "CoordinateSpace Begin\n");
+		fprintf(fp, "\tDatum = \"%s\"\n", Datum.c_str());
+		fprintf(fp, "\tProjection = \"%s\"\n", Projection.c_str());
+		fprintf(fp, "\tCoordinateType = \"%s\"\n", CoordinateType.c_str());
+		fprintf(fp, "CoordinateSpace End\n");
+		fclose(fp);
+		return true;
+	}
 	
 };
 
@@ -1039,6 +1109,101 @@ public:
 		_GSTITEM_
 	}
 
+	//Creates an empty line dataset (INDEX.PD and SurveyInfo) with the given number of samples in each line, fields are then added with addfield()
+	bool create_new(const std::string& _datasetpath, const std::vector<size_t>& linesamplecount)
+	{
+		_GSTITEM_
+		valid = false;
+		Fields.clear();
+
+		datasetpath = strippath(_datasetpath);
+		if (datasetpath.size() <= 0){
+			glog.logmsg("ILDataset: invalid dataset path: %s\n\n", datasetpath.c_str());
+			return false;
+		}
+		makedirectorydeep(datasetpath);
+		indexpath = datasetpath + "INDEX.PD";
+		surveyinfopath = datasetpath + "SurveyInfo";
+
+		indextable.resize(linesamplecount.size());
+		size_t start = 0;
+		size_t maxns = 0;
+		for (size_t li = 0; li < linesamplecount.size(); li++){
+			indextable[li].start = start;
+			indextable[li].ns = linesamplecount[li];
+			indextable[li].dummy1 = 0;
+			indextable[li].dummy2 = 0;
+			start += linesamplecount[li];
+			if (linesamplecount[li] > maxns) maxns = linesamplecount[li];
+		}
+
+		Header = IHeader();
+		Header.filetype = IHeader::FileType::INDEX;
+		Header.accesstype = IHeader::AccessType::DIRECT;
+		Header.packingtype = IHeader::PackingType::BIL;
+		Header.datatype = IDataType(IDataType::ID::INT);
+		Header.nlines = linesamplecount.size();
+		Header.maxspl = maxns;
+		Header.nbands = 4;
+		Header.headeroffset = IHeader::nbytes();
+		Header.endianswap = false;
+		Header.valid = true;
+
+		int16_t hdata[256];
+		for (size_t i = 0; i < 256; i++) hdata[i] = 0;
+		hdata[72] = 1002; //INDEX
+		hdata[73] = 2; hdata[90] = 32;
+		hdata[79] = (int16_t)IHeader::nbytes();
+		hdata[81] = 1;
+		hdata[91] = 1;
+		IHeader::setint32(hdata, 217, nlines());
+		IHeader::setint32(hdata, 219, maxspl());
+		IHeader::setint32(hdata, 221, Header.nbands);
+
+		FILE* findex = fileopen(indexpath, "wb");
+		if (findex == NULL) {
+			glog.logmsg("ILDataset: cannot create file %s\n\n", indexpath.c_str());
+			return false;
+		}
+		std::vector<int32_t> indexdata(nlines() * 4);
+		for (size_t li = 0; li < nlines(); li++){
+			indexdata[li * 4] = (int32_t)indextable[li].start;
+			indexdata[li * 4 + 1] = (int32_t)indextable[li].ns;
+			indexdata[li * 4 + 2] = 0;
+			indexdata[li * 4 + 3] = 0;
+		}
+		fwrite((char*)hdata, IHeader::nbytes(), 1, findex);
+		size_t n = fwrite(indexdata.data(), 16, nlines(), findex);
+		fclose(findex);
+		if (n != nlines()){
+			glog.logmsg("ILDataset: error writing INDEX file: %s\n\n", indexpath.c_str());
+			return false;
+		}
+
+		FILE* fsurveyinfo = fileopen(surveyinfopath, "w");
+		if (fsurveyinfo == NULL) {
+			glog.logmsg("ILDataset: cannot create file %s\n\n", surveyinfopath.c_str());
+			return false;
+		}
+		fclose(fsurveyinfo);
+		SurveyInfo.clear();
+
+		valid = true;
+		return true;
+	}
+
+	//Adds a key = value entry to the SurveyInfo file
+	bool addsurveyinfo(const std::string& key, const std::string& value)
+	{
+		_GSTITEM_
+		FILE* fsurveyinfo = fileopen(surveyinfopath, "a");
+		if (fsurveyinfo == NULL) return false;
+		fprintf(fsurveyinfo, "%s = %s\n", key.c_str(), value.c_str());
+		fclose(fsurveyinfo);
+		SurveyInfo.push_back({ key, value });
+		return true;
+	}
+
 	std::vector<IndexTable> indextable;
 	std::vector<cLineSeg> bestfitlinesegs;
 	
@@ -1204,7 +1369,7 @@ public:
 		_GSTITEM_
 		std::string fieldname;
 		bool status = surveyinfofieldname(key,fieldname);
-		if (status){
+		if (status == false){
 			printf("Cannot find field %s from SurveyInfo:\n\n", key.c_str());
 			return getNullField();
 		}
@@ -1316,6 +1481,10 @@ public:
 		for (size_t li = 0; li<nlines(); li++){
 			ILSegment sX(fX,li);
 			ILSegment sY(fY,li);
+			sX.createbuffer();
+			sY.createbuffer();
+			sX.readbuffer();
+			sY.readbuffer();
 			size_t numsamples = sX.nsamples();
 
 			////Find first and last non nulls
@@ -1458,26 +1627,17 @@ public:
 		lineindex = nearestbestfitline(p);
 		sampleindex = 0;
 
-		double mindistance;
-
 		ILField& fX = getsurveyinfofield("X");
 		ILField& fY = getsurveyinfofield("Y");
 
-		ILSegment sX(fX,lineindex);
-		ILSegment sY(fY,lineindex);
+		std::vector<double> vx, vy;
+		if (readxy(fX, fY, lineindex, vx, vy) == false || vx.empty()) return DBL_MAX;
 
-		for (size_t si = 0; si<sX.nsamples(); si++){
-			double dx = p.x - sX.d(si);
-			double dy = p.y - sY.d(si);
-			double d = sqrt(dx*dx + dy*dy);
-			if (si == 0)mindistance = d;
-			if (d <= mindistance){
-				mindistance = d;
-				sampleindex = si;
-				x = sX.d(si);
-				y = sY.d(si);
-			}
-		}
+		//Plan distance
+		double mindistance;
+		sampleindex = cPntArray(vx, vy).nearest(cPnt(p.x, p.y, 0.0), mindistance);
+		x = vx[sampleindex];
+		y = vy[sampleindex];
 		return mindistance;
 	}
 
@@ -1490,20 +1650,18 @@ public:
 		ILField& fX = getsurveyinfofield("X");
 		ILField& fY = getsurveyinfofield("Y");
 
+		std::vector<double> vx, vy;
+		std::vector<size_t> index;
 		for (size_t li = 0; li<nlines(); li++){
 			double d = distancetobestfitline(p, li);
 			if (d<distance*2.0){
-				ILSegment sX(fX,li);
-				ILSegment sY(fY,li);
-				size_t nsam = sX.nsamples();
-				for (size_t si = 0; si<nsam; si++){
-					cPnt p1(sX.d(si), sY.d(si), 0.0);
-					if (p.distance(p1) <= distance){
-						struct SampleIndex sam;
-						sam.lineindex = li;
-						sam.sampleindex = si;
-						samples.push_back(sam);
-					}
+				if (readxy(fX, fY, li, vx, vy) == false) continue;
+				cPntArray(vx, vy).withindistance(p, distance, index);
+				for (size_t k = 0; k < index.size(); k++){
+					struct SampleIndex sam;
+					sam.lineindex = li;
+					sam.sampleindex = index[k];
+					samples.push_back(sam);
 				}
 			}
 		}
@@ -1512,6 +1670,18 @@ public:
 		return samples;
 	}
 
+	//Coordinates of all samples on a line as contiguous arrays for the cPntArray kernels
+	bool readxy(ILField& fX, ILField& fY, const size_t lineindex, std::vector<double>& vx, std::vector<double>& vy)
+	{
+		ILSegment sX(fX, lineindex);
+		ILSegment sY(fY, lineindex);
+		sX.createbuffer();
+		sY.createbuffer();
+		if (sX.readbuffer() == false || sY.readbuffer() == false) return false;
+		if (sX.getband(vx) == false || sY.getband(vy) == false) return false;
+		return vx.size() == vy.size();
+	}
+
 	SampleIndex linefid_index(int linenumber, int fidnumber)
 	{
 		_GSTITEM_
@@ -1536,21 +1706,35 @@ public:
 	cStats<double> fieldstats(const std::string& fieldname){
 		_GSTITEM_
 		ILField& F = getfield(fieldname);
-		std::vector<double> v;
-		v.reserve(nsamples());		
+		cRunningStats<double> r;
 		for (size_t li = 0; li < nlines(); li++){
-			ILSegment S(F,li);			
-			S.readbuffer();	
-			size_t nsamples = S.nsamples();			
-			for (size_t si = 0; si < nsamples; si++){				
+			ILSegment S(F,li);
+			S.readbuffer();
+			size_t nsamples = S.nsamples();
+			for (size_t si = 0; si < nsamples; si++){
 				double val = S.d(si);
-				if (IDataType::isnull(val)==false){
-					v.push_back(val);					
-				}				
+				if (IDataType::isnull(val)) r.nulls++;
+				else r.add(val);
 			}
-		}				
-		cStats<double> stats(v);
-		return stats;		
+		}
+		return r.stats();
+	}
+
+	//Approximate quantiles of a field in bounded memory
+	std::vector<double> fieldquantiles(const std::string& fieldname, const std::vector<double>& q){
+		_GSTITEM_
+		ILField& F = getfield(fieldname);
+		cQuantileSketch<double> sketch;
+		for (size_t li = 0; li < nlines(); li++){
+			ILSegment S(F,li);
+			S.readbuffer();
+			size_t nsamples = S.nsamples();
+			for (size_t si = 0; si < nsamples; si++){
+				double val = S.d(si);
+				if (IDataType::isnull(val)==false) sketch.add(val);
+			}
+		}
+		return sketch.quantiles(q);
 	}
 	
 	template<typename T>
@@ -1700,7 +1884,7 @@ bool ILSegment::readbuffer()
 bool ILSegment::writebuffer()
 {
 	size_t n;
-	Field.open();
+	if (Field.openforwrite() == false) return false;
 	long move = fileposition() - ftell(filepointer());
 	fseek(filepointer(), move, SEEK_CUR);
 
@@ -1772,9 +1956,9 @@ bool ILField::create_new(const std::string& fieldname, const IDataType& _datatyp
 	hdata[33] = (int16_t)Dataset.nlines();
 	hdata[34] = (int16_t)_nbands;	
 
-	hdata[217] = (int16_t)Dataset.maxspl();
-	hdata[219] = (int16_t)Dataset.nlines();
-	hdata[221] = (int16_t)_nbands;
+	IHeader::setint32(hdata, 217, Dataset.maxspl());
+	IHeader::setint32(hdata, 219, Dataset.nlines());
+	IHeader::setint32(hdata, 221, _nbands);
 
 	if (_indexed) {
 		Header.accesstype = IHeader::AccessType::INDEXED;
@@ -1844,6 +2028,7 @@ bool ILField::create_new(const std::string& fieldname, const IDataType& _datatyp
 		return false;
 	}
 	fclose(lfile);
+	if (write_datum_projection() == false) return false;
 	open();
 	close();
 	return true;
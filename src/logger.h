@@ -17,6 +17,12 @@ Author: Ross C. Brodie, Geoscience Australia.
 #include <cstdio>
 #include <vector>
 #include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
 
 #if defined _OPENMP
 	#include <omp.h>
@@ -38,11 +44,130 @@ class cLogger; //forward declaration only
 extern class cLogger glog; //The global instance of the log file manager
 #define _SRC_ cLogger::src_code_location(__FILE__, __FUNCTION__, __LINE__)
 
+//A message queued for the asynchronous writer, tagged when it was enqueued
+class cLogRecord
+{
+public:
+	std::string msg;
+	std::chrono::system_clock::time_point time;
+	int thread = 0;
+	bool tofile = true;
+	bool toconsole = true;
+};
+
+//Lock-free multiple-producer single-consumer queue (Vyukov intrusive list).
+//Nodes are recycled rather than freed: the consumer pushes spent nodes onto a shared free list and a producer
+//that runs out takes the whole list at once into its own thread local cache, so in steady state push() does not
+//allocate. Only the consumer pushes and producers only exchange the whole list, so the free list has no ABA problem.
+class cLogQueue
+{
+	private:
+		struct sNode {
+			std::atomic<sNode*> next;
+			cLogRecord record;
+			sNode() : next(nullptr) {};
+		};
+
+		//Per thread cache of free nodes, shared by all queues since nodes carry no queue state
+		struct sNodeCache {
+			sNode* first = nullptr;
+			~sNodeCache() {
+				while (first) {
+					sNode* n = first->next.load(std::memory_order_relaxed);
+					delete first;
+					first = n;
+				}
+			}
+		};
+
+		std::atomic<sNode*> head;//producers push here
+		sNode* tail;//only the consumer touches this
+		std::atomic<sNode*> freelist{nullptr};
+
+		static sNodeCache& cache() {
+			static thread_local sNodeCache c;
+			return c;
+		}
+
+		sNode* allocate() {
+			sNodeCache& c = cache();
+			if (c.first == nullptr) c.first = freelist.exchange(nullptr, std::memory_order_acquire);
+			if (c.first == nullptr) return new sNode;
+			sNode* n = c.first;
+			c.first = n->next.load(std::memory_order_relaxed);
+			n->next.store(nullptr, std::memory_order_relaxed);
+			return n;
+		}
+
+		void recycle(sNode* n) {
+			sNode* f = freelist.load(std::memory_order_relaxed);
+			do {
+				n->next.store(f, std::memory_order_relaxed);
+			} while (freelist.compare_exchange_weak(f, n, std::memory_order_release, std::memory_order_relaxed) == false);
+		}
+
+	public:
+
+		cLogQueue() {
+			sNode* stub = new sNode;
+			head.store(stub);
+			tail = stub;
+		};
+
+		~cLogQueue() {
+			cLogRecord r;
+			while (pop(r));
+			delete tail;
+			sNode* n = freelist.exchange(nullptr);
+			while (n) {
+				sNode* next = n->next.load(std::memory_order_relaxed);
+				delete n;
+				n = next;
+			}
+		};
+
+		void push(cLogRecord&& r) {
+			sNode* n = allocate();
+			n->record = std::move(r);
+			sNode* prev = head.exchange(n, std::memory_order_acq_rel);
+			prev->next.store(n, std::memory_order_release);
+		};
+
+		bool pop(cLogRecord& r) {
+			sNode* next = tail->next.load(std::memory_order_acquire);
+			if (next == nullptr) return false;
+			r = std::move(next->record);
+			recycle(tail);
+			tail = next;
+			return true;
+		};
+
+		//Consumer only
+		bool empty() const {
+			return tail->next.load(std::memory_order_seq_cst) == nullptr;
+		};
+};
+
 class cLogger
 {
 	private:
 		std::vector<std::ofstream> ofs;
 
+		//Asynchronous mode state
+		std::atomic<bool> async{false};
+		std::atomic<bool> tagmessages{false};
+		int tagrank = 0;
+		cLogQueue queue;
+		std::thread writer;
+		std::atomic<bool> stopwriter{false};
+		std::atomic<size_t> nqueued{0};
+		std::atomic<size_t> nwritten{0};
+		std::atomic<bool> writersleeping{false};
+		std::mutex streammutex;//held by the writer while it uses ofs, and by anything that opens, closes or resizes ofs
+		std::mutex wakemutex;
+		std::condition_variable wakewriter;
+		std::condition_variable drained;
+
 		void closeindex(const int i)
 		{
 			if ((int)ofs.size() > i) {
@@ -77,48 +202,178 @@ class cLogger
 			return ofs[i];
 		}
 
+		void enqueue(std::string&& msg, const bool tofile, const bool toconsole)
+		{
+			cLogRecord r;
+			r.msg = std::move(msg);
+			r.time = std::chrono::system_clock::now();
+			r.thread = threadindex();
+			r.tofile = tofile;
+			r.toconsole = toconsole;
+			queue.push(std::move(r));
+			nqueued.fetch_add(1, std::memory_order_release);
+
+			//Wake the writer if it has gone to sleep on an empty queue
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (writersleeping.load(std::memory_order_relaxed) && writersleeping.exchange(false)) {
+				std::lock_guard<std::mutex> lock(wakemutex);
+				wakewriter.notify_one();
+			}
+		}
+
+		std::string tag(const cLogRecord& r)
+		{
+			const std::time_t t = std::chrono::system_clock::to_time_t(r.time);
+			const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(r.time.time_since_epoch()).count() % 1000;
+			char buf[32];
+			std::strftime(buf, sizeof(buf), "%H:%M:%S", std::localtime(&t));
+			return strprint("[%s.%03lld r%d t%d] ", buf, ms, tagrank, r.thread);
+		}
+
+		void writerloop()
+		{
+			//Drains the queue in batches, one write and one flush per stream per batch
+			std::vector<std::string> filebuf;
+			std::string consolebuf;
+			cLogRecord r;
+			while (true) {
+				size_t n = 0;
+				std::unique_lock<std::mutex> streamlock(streammutex);
+				const bool tagging = tagmessages.load();
+				while (queue.pop(r)) {
+					std::string s = tagging ? tag(r) + r.msg : r.msg;
+					if (r.tofile && r.thread < (int)ofs.size()) {
+						if ((int)filebuf.size() <= r.thread) filebuf.resize(r.thread + 1);
+						filebuf[r.thread] += s;
+					}
+					if (r.toconsole) consolebuf += s;
+					n++;
+				}
+
+				if (n > 0) {
+					for (size_t i = 0; i < filebuf.size(); i++) {
+						if (filebuf[i].size() > 0 && ofs[i].is_open()) ofs[i] << filebuf[i] << std::flush;
+						filebuf[i].clear();
+					}
+					streamlock.unlock();
+					if (consolebuf.size() > 0) std::cout << consolebuf << std::flush;
+					consolebuf.clear();
+					std::lock_guard<std::mutex> lock(wakemutex);
+					nwritten.fetch_add(n, std::memory_order_release);
+					drained.notify_all();
+					continue;
+				}
+
+				streamlock.unlock();
+				std::unique_lock<std::mutex> lock(wakemutex);
+				if (stopwriter.load() && nwritten.load() == nqueued.load()) break;
+				//Producers notify when they see this flag, the timeout is only a backstop
+				writersleeping.store(true);
+				if (queue.empty() && stopwriter.load() == false) {
+					wakewriter.wait_for(lock, std::chrono::milliseconds(100));
+				}
+				writersleeping.store(false);
+			}
+		}
+
+		void flushasync()
+		{
+			//Block until everything queued so far has been written
+			const size_t target = nqueued.load(std::memory_order_acquire);
+			std::unique_lock<std::mutex> lock(wakemutex);
+			wakewriter.notify_one();
+			drained.wait(lock, [&]{ return nwritten.load(std::memory_order_acquire) >= target; });
+		}
+
 public:
 
 	cLogger() {};
 
 	void set_num_omp_threads(const size_t& n){
+		std::lock_guard<std::mutex> lock(streammutex);
 		ofs.resize(n);
 	}
 
+	//In asynchronous mode messages are queued by the calling thread and written in batches by a background thread.
+	//Open the log files and call set_num_omp_threads() before switching it on.
+	//Warnings, errors, flush(), close() and the destructor wait for the queue to drain.
+	void set_async(const bool on, const bool tag = false)
+	{
+		if (on == async.load()) {
+			tagmessages.store(tag);
+			return;
+		}
+
+		if (on) {
+			tagmessages.store(tag);
+			tagrank = mpi_openmp_rank();
+			stopwriter.store(false);
+			async.store(true);
+			writer = std::thread(&cLogger::writerloop, this);
+		}
+		else {
+			async.store(false);
+			{
+				std::lock_guard<std::mutex> lock(wakemutex);
+				stopwriter.store(true);
+				wakewriter.notify_one();
+			}
+			writer.join();
+		}
+	}
+
+	bool is_async() const
+	{
+		return async.load();
+	}
+
 	bool open(const std::string& logfilename)
 	{
 		const size_t i = (size_t)threadindex();
-		if (ofs.size() < i + 1) {
-			ofs.resize(i + 1);
-		}
 		makedirectorydeep(extractfiledirectory(logfilename));
-		ofs[i].open(logfilename, std::ios_base::out);
+		bool failed;
+		{
+			std::lock_guard<std::mutex> lock(streammutex);
+			if (ofs.size() < i + 1) {
+				ofs.resize(i + 1);
+			}
+			ofs[i].open(logfilename, std::ios_base::out);
+			failed = ofs[i].fail();
+			if (failed == false) ofs[i] << "Logfile opened on " << timestamp() << std::endl << std::flush;
+		}
 
-		if (ofs[i].fail()) {
+		if (failed) {
 			glog.errormsg(_SRC_,"Failed to open Log file %s", logfilename.c_str());
 		}
-		ofs[i] << "Logfile opened on " << timestamp() << std::endl << std::flush;
 		return true;
 	}
 
 	void flush()
 	{
-		flushindex(threadindex());
+		if (async.load()) flushasync();
+		else flushindex(threadindex());
 	}
 
 	void close()
 	{
+		if (async.load()) flushasync();
+		std::lock_guard<std::mutex> lock(streammutex);
 		closeindex(threadindex());
 	}
 
 	~cLogger()
 	{
+		set_async(false);
 		for (size_t i = 0; i < ofs.size(); i++) {
 			closeindex((int)i);
 		}
 	};
 
 	void log(const std::string& msg) {
+		if (async.load(std::memory_order_relaxed)) {
+			enqueue(std::string(msg), true, false);
+			return;
+		}
 		std::ofstream& fs = ostrm();
 		if (ofs.size() > 0 && fs.is_open()) fs << msg << std::flush;
 	};
@@ -133,6 +388,10 @@ public:
 	}
 
 	void logmsg(const std::string& msg){
+		if (async.load(std::memory_order_relaxed)) {
+			enqueue(std::string(msg), true, true);
+			return;
+		}
 		std::ofstream& fs = ostrm();
 		if ((int)ofs.size()>0 && fs.is_open()) fs << msg << std::flush;
 		std::cout << msg << std::flush;
@@ -148,6 +407,10 @@ public:
 	}
 
 	void logmsg(const int& rank, const std::string& msg) {
+		if (async.load(std::memory_order_relaxed)) {
+			enqueue(std::string(msg), true, mpi_openmp_rank() == rank);
+			return;
+		}
 		log(msg);
 		if (mpi_openmp_rank() == rank) {
 			std::cout << msg << std::flush;
@@ -176,6 +439,7 @@ public:
 			logmsg(msg);
 		#endif
 		logmsg(strprint("%s\n",srccodeloc.c_str()));
+		if (async.load()) flushasync();
 	}
 
 	void errormsg(const std::string& srccodeloc, const char* fmt, ...)
@@ -189,6 +453,7 @@ public:
 			mexErrMsgTxt(msg.c_str());
 		#else
 			logmsg(msg);
+			if (async.load()) flushasync();
 			throw(std::runtime_error(strprint("Exception throw from %s\n", srccodeloc.c_str())));
 		#endif
 	}
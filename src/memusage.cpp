@@ -72,18 +72,48 @@ memUsage::memUsage(std::string name){
 
 /////////////////////////////////////////////////////////////////////
 void memUsage::reset() {
-
+	//Starts a new phase, the rss change is measured from here
+	start.read();
+}
+/////////////////////////////////////////////////////////////////////
+void memUsage::resetpeak() {
+	//Process-wide, also restarts the VmHWM peak seen by any other memUsage or the profiler
+	cMemoryStatus::resetpeak();
+	start.read();
 }
 ////////////////////////////////////////////////////////////////////////////
 void memUsage::report() {
-	
-
+	cMemoryStatus now(false);
+	cMemoryStatus d = now - start;
+	glog.logmsg("[%d] %s Memory: %s Change: %+.1lf MB\n", mpi_openmp_rank(), nametag.c_str(), now.infostring().c_str(), d.rss / 1024.0);
+}
+////////////////////////////////////////////////////////////////////////////
+void memUsage::report1() {
+	cMemoryStatus now(true);
+	cMemoryStatus d = now - start;
+	glog.logmsg("-----------------------------------%s---------------------------------------\n", nametag.c_str());
+	glog.logmsg("Rank: %d\n", mpi_openmp_rank());
+	glog.logmsg("Resident memory: %.1lf Mb\n", now.rss / 1024.0);
+	glog.logmsg("Peak resident memory since start or resetpeak(): %.1lf Mb\n", now.hwm / 1024.0);
+	glog.logmsg("Anonymous resident memory: %.1lf Mb\n", now.anonymous / 1024.0);
+	glog.logmsg("File-mapped resident memory: %.1lf Mb\n", now.filemapped / 1024.0);
+	glog.logmsg("Proportional set size: %.1lf Mb\n", now.pss / 1024.0);
+	glog.logmsg("Swapped memory: %.1lf Mb\n", now.swap / 1024.0);
+	glog.logmsg("Virtual memory: %.1lf Mb\n", now.vmsize / 1024.0);
+	glog.logmsg("Resident memory change since reset: %+.1lf Mb\n", d.rss / 1024.0);
+	glog.logmsg("-----------------------------------%s---------------------------------------\n", nametag.c_str());
+}
+/////////////////////////////////////////////////////////////////////
+cMemoryStatus memUsage::snapshot(const bool rollup) {
+	return cMemoryStatus(rollup);
+}
+/////////////////////////////////////////////////////////////////////
+cMemoryStatus memUsage::diff(const bool rollup) {
+	return cMemoryStatus(rollup) - start;
 }
-
 /////////////////////////////////////////////////////////////////////
 void memUsage::rename(std::string name) {
 	nametag=name;	
 }
 
 #endif
-
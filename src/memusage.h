@@ -15,15 +15,118 @@ Author: Ross C. Brodie, Geoscience Australia.
 #endif
 
 #include "string"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
 using namespace std;
 
+//Process memory in kilobytes, read from /proc/self/status and optionally /proc/self/smaps_rollup on Linux
+class cMemoryStatus {
+
+public:
+	int64_t vmsize = 0;
+	int64_t vmpeak = 0;
+	int64_t rss = 0;
+	int64_t hwm = 0;//peak rss since start or the last resetpeak()
+	int64_t anonymous = 0;
+	int64_t filemapped = 0;
+	int64_t swap = 0;
+	int64_t pss = 0;//only from smaps_rollup
+
+	cMemoryStatus() {};
+
+	cMemoryStatus(const bool rollup) {
+		read(rollup);
+	};
+
+	bool read(const bool rollup = false) {
+	#if defined(__linux__)
+		FILE* fp = fopen("/proc/self/status", "r");
+		if (fp == NULL) return false;
+		char line[256];
+		while (fgets(line, sizeof(line), fp)) {
+			parseline(line, "VmSize:", vmsize);
+			parseline(line, "VmPeak:", vmpeak);
+			parseline(line, "VmRSS:", rss);
+			parseline(line, "VmHWM:", hwm);
+			parseline(line, "RssAnon:", anonymous);
+			parseline(line, "RssFile:", filemapped);
+			parseline(line, "VmSwap:", swap);
+		}
+		fclose(fp);
+
+		if (rollup) {
+			//smaps_rollup walks the page tables so is much slower than status
+			fp = fopen("/proc/self/smaps_rollup", "r");
+			if (fp == NULL) return true;
+			while (fgets(line, sizeof(line), fp)) {
+				parseline(line, "Pss:", pss);
+			}
+			fclose(fp);
+		}
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+	static void parseline(const char* line, const char* key, int64_t& value) {
+		const size_t n = strlen(key);
+		if (strncmp(line, key, n) == 0) value = (int64_t)strtoll(line + n, NULL, 10);
+	}
+
+	//Reset the kernel's VmHWM peak rss to the current rss (Linux 4.0+)
+	static bool resetpeak() {
+	#if defined(__linux__)
+		FILE* fp = fopen("/proc/self/clear_refs", "w");
+		if (fp == NULL) return false;
+		bool status = fputs("5", fp) >= 0;
+		fclose(fp);
+		return status;
+	#else
+		return false;
+	#endif
+	}
+
+	cMemoryStatus operator-(const cMemoryStatus& b) const {
+		cMemoryStatus d;
+		d.vmsize = vmsize - b.vmsize;
+		d.vmpeak = vmpeak - b.vmpeak;
+		d.rss = rss - b.rss;
+		d.hwm = hwm - b.hwm;
+		d.anonymous = anonymous - b.anonymous;
+		d.filemapped = filemapped - b.filemapped;
+		d.swap = swap - b.swap;
+		d.pss = pss - b.pss;
+		return d;
+	}
+
+	std::string infostring() const {
+		char buf[256];
+		snprintf(buf, sizeof(buf), "RSS %.1lf MB Peak %.1lf MB Anon %.1lf MB File %.1lf MB Swap %.1lf MB Virtual %.1lf MB",
+			rss / 1024.0, hwm / 1024.0, anonymous / 1024.0, filemapped / 1024.0, swap / 1024.0, vmsize / 1024.0);
+		std::string s(buf);
+		if (pss) {
+			snprintf(buf, sizeof(buf), " PSS %.1lf MB", pss / 1024.0);
+			s += buf;
+		}
+		return s;
+	}
+};
+
 class memUsage {
 
 #if defined(_WIN32)	//windows
 
 private:
     MEMORYSTATUS memstart;    		
-  
+
+#else
+
+public:
+	cMemoryStatus start;
+
 #endif 
 
 public:
@@ -34,6 +137,12 @@ public:
 	void report();  
 	void report1();  
 
+#if !defined(_WIN32)
+	void resetpeak();
+	cMemoryStatus snapshot(const bool rollup = false);
+	cMemoryStatus diff(const bool rollup = false);
+#endif
+
 };
 
 #endif
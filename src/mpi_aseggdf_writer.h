@@ -0,0 +1,144 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _mpi_aseggdf_writer_H
+#define _mpi_aseggdf_writer_H
+
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <mpi.h>
+
+#include "general_utils.h"
+#include "file_formats.h"
+#include "mpi_wrapper.h"
+
+//Collective writer of one ASEG-GDF2 .dat file from all ranks of a communicator.
+//Each rank formats its own records with the cOutputFileInfo field formats into a local buffer. flush() is collective:
+//an exclusive scan of the buffer lengths gives every rank its byte offset, then all ranks write together with
+//MPI_File_write_at_all, so the file holds rank 0's records, then rank 1's, and so on for each flush.
+//Offsets come from actual lengths, so a value that overflows its field width cannot corrupt other ranks' records.
+//The DFN header is written once by rank 0.
+//close() is collective and must be called explicitly on every rank. The destructor does not close the file, since
+//it may run on one rank only while an exception unwinds; it just discards unwritten records and warns.
+class cMpiAsegGdfWriter{
+
+	static const size_t MAXWRITE = (size_t)1 << 30;//bytes per MPI write call, keeps counts within int
+
+	cMpiComm comm;
+	cOutputFileInfo info;
+	MPI_File fh = MPI_FILE_NULL;
+	MPI_Offset filesize = 0;//bytes written by all ranks so far
+	std::string buffer;
+	std::string record;
+	size_t fi = 0;//next field in the current record
+	size_t nrecords = 0;
+
+	void checkfield() const {
+		if (fi >= info.fields.size()){
+			throw(std::runtime_error(strprint("cMpiAsegGdfWriter: more than the %zu fields in a record", info.fields.size())));
+		}
+	}
+
+public:
+
+	//Collective. Creates (or truncates) datpath, and if dfnpath is not empty writes the header there from rank 0.
+	cMpiAsegGdfWriter(const MPI_Comm& _comm, const cOutputFileInfo& _info, const std::string& datpath, const std::string& dfnpath = ""){
+		comm.set(_comm);
+		info = _info;
+		int ierr = MPI_File_open(comm.get(), datpath.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+		if (comm.chkerr(ierr) == false){
+			throw(std::runtime_error(strprint("cMpiAsegGdfWriter: could not open %s", datpath.c_str())));
+		}
+		MPI_File_set_size(fh, 0);
+		if (dfnpath.size() > 0 && comm.rank() == 0) info.write_aseggdf_header(dfnpath);
+		record.reserve(info.recordwidth() + 1);
+	}
+
+	~cMpiAsegGdfWriter(){
+		if (fh != MPI_FILE_NULL){
+			glog.logmsg("**Warning: cMpiAsegGdfWriter destroyed without close(), %zu unwritten records discarded\n", nrecords);
+		}
+	}
+
+	cMpiAsegGdfWriter(const cMpiAsegGdfWriter&) = delete;
+	cMpiAsegGdfWriter& operator=(const cMpiAsegGdfWriter&) = delete;
+
+	//Append the next field of the current record, one value per band
+	void addfield(const double* v){
+		checkfield();
+		info.formatfield(record, fi++, v);
+	}
+
+	void addfield(const double v){
+		checkfield();
+		info.formatfield(record, fi++, v);
+	}
+
+	//Completes the current record and queues it for the next flush
+	void endrecord(){
+		if (fi != info.fields.size()){
+			throw(std::runtime_error(strprint("cMpiAsegGdfWriter: record has %zu fields, expected %zu", fi, info.fields.size())));
+		}
+		buffer += record;
+		buffer += '\n';
+		record.clear();
+		fi = 0;
+		nrecords++;
+	}
+
+	//A record formatted elsewhere, without the newline
+	void addrecord(const std::string& r){
+		buffer += r;
+		buffer += '\n';
+		nrecords++;
+	}
+
+	//Records queued on this rank since the last flush
+	size_t pending() const {
+		return nrecords;
+	}
+
+	//Collective. Writes every rank's queued records in rank order after everything already written.
+	bool flush(){
+		if (fh == MPI_FILE_NULL) return false;
+		long long mine = (long long)buffer.size();
+		long long before = 0;
+		int ierr = MPI_Exscan(&mine, &before, 1, MPI_LONG_LONG, MPI_SUM, comm.get());
+		comm.chkerr(ierr);
+		if (comm.rank() == 0) before = 0;
+		const long long total = comm.allreduce(mine);
+
+		//Every rank must make the same number of collective calls
+		const long long ncalls = comm.allreduce((mine + (long long)MAXWRITE - 1) / (long long)MAXWRITE, MPI_MAX);
+		bool status = true;
+		size_t done = 0;
+		for (long long k = 0; k < ncalls; k++){
+			const size_t n = std::min((size_t)MAXWRITE, buffer.size() - done);
+			MPI_Status s;
+			ierr = MPI_File_write_at_all(fh, filesize + (MPI_Offset)before + (MPI_Offset)done, buffer.data() + done, (int)n, MPI_CHAR, &s);
+			status &= comm.chkerr(ierr);
+			done += n;
+		}
+		filesize += (MPI_Offset)total;
+		buffer.clear();
+		nrecords = 0;
+		return status;
+	}
+
+	//Collective. Flushes and closes the file.
+	bool close(){
+		if (fh == MPI_FILE_NULL) return true;
+		bool status = flush();
+		int ierr = MPI_File_close(&fh);
+		fh = MPI_FILE_NULL;
+		return status && comm.chkerr(ierr);
+	}
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _mpi_taskfarm_H
+#define _mpi_taskfarm_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+
+#include "general_utils.h"
+#include "logger.h"
+#include "mpi_wrapper.h"
+
+//Dynamic load balancing of independent tasks 0..ntasks-1 (e.g. per sounding inversions) across the ranks of a communicator.
+//Rank 0 hands out chunks of task ids using guided self-scheduling: each chunk is remaining/(chunkfactor*nranks),
+//clamped to [minchunk,maxchunk], so chunks are large early and small near the end where imbalance matters.
+//Workers always keep the request for their next chunk in flight while they work on the current one, so the
+//round trip to rank 0 is hidden. Rank 0 also does work between servicing requests unless masterworks is false,
+//which is better when single tasks are long compared with a chunk on the workers.
+class cMpiTaskFarm{
+
+	enum { TAG_REQUEST = 7301, TAG_CHUNK = 7302 };
+
+	size_t ntasks = 0;
+	size_t next = 0;//first task not yet handed out (rank 0 only)
+
+	//Per rank accounting, seconds
+	double busy = 0.0;
+	double waiting = 0.0;
+	double wall = 0.0;
+	size_t ntasksdone = 0;
+	size_t nchunks = 0;
+
+	size_t chunksize(){
+		const size_t remaining = ntasks - next;
+		size_t c = (size_t)std::ceil((double)remaining / (chunkfactor * (double)comm.size()));
+		c = std::max(c, minchunk);
+		c = std::min(c, maxchunk);
+		return std::min(c, remaining);
+	}
+
+	void takechunk(size_t& begin, size_t& end){
+		begin = next;
+		end = next + chunksize();
+		next = end;
+	}
+
+	template < typename F >
+	void dochunk(const size_t begin, const size_t end, F& task){
+		const double t0 = MPI_Wtime();
+		for (size_t i = begin; i < end; i++) task(i);
+		busy += MPI_Wtime() - t0;
+		ntasksdone += end - begin;
+		nchunks++;
+	}
+
+	//Rank 0: reply to the request that has just completed and, while some worker may still ask, post the next receive
+	void answer(int& requester, cMpiRequest& request, cMpiRequestSet& replies, size_t& finished, const size_t nworkers){
+		const int source = request.status.MPI_SOURCE;
+		std::vector<size_t> chunk(2);
+		takechunk(chunk[0], chunk[1]);
+		if (chunk[0] == chunk[1]) finished++;
+		replies.add(comm.isend_vec(std::move(chunk), source, TAG_CHUNK));
+		replies.progress();
+		if (finished < nworkers) request = comm.irecv(requester, MPI_ANY_SOURCE, TAG_REQUEST);
+	}
+
+	//Rank 0: answer any requests that have arrived without blocking
+	void service(int& requester, cMpiRequest& request, cMpiRequestSet& replies, size_t& finished, const size_t nworkers){
+		while (request.pending() && request.test()){
+			answer(requester, request, replies, finished, nworkers);
+		}
+	}
+
+	template < typename F >
+	void runmaster(F& task){
+		const size_t nworkers = (size_t)comm.size() - 1;
+		size_t finished = 0;
+		int requester = 0;
+		cMpiRequestSet replies;
+		cMpiRequest request;
+		if (nworkers > 0) request = comm.irecv(requester, MPI_ANY_SOURCE, TAG_REQUEST);
+
+		if (masterworks || nworkers == 0){
+			//One task at a time so requests are answered promptly
+			while (next < ntasks){
+				const size_t i = next++;
+				dochunk(i, i + 1, task);
+				service(requester, request, replies, finished, nworkers);
+			}
+		}
+
+		//Keep answering, blocking, until every worker has been told to stop
+		const double t0 = MPI_Wtime();
+		while (finished < nworkers){
+			request.wait();
+			answer(requester, request, replies, finished, nworkers);
+		}
+		replies.waitall();
+		waiting += MPI_Wtime() - t0;
+	}
+
+	template < typename F >
+	void runworker(F& task){
+		const int me = comm.rank();
+		std::vector<size_t> current(2), prefetch(2);
+
+		cMpiRequest ask = comm.isend(me, 0, TAG_REQUEST);
+		cMpiRequest reply = comm.irecv_into(current, 0, TAG_CHUNK);
+		double t0 = MPI_Wtime();
+		reply.wait();
+		ask.wait();
+		waiting += MPI_Wtime() - t0;
+
+		while (current[0] < current[1]){
+			//Ask for the next chunk before starting on this one
+			ask = comm.isend(me, 0, TAG_REQUEST);
+			reply = comm.irecv_into(prefetch, 0, TAG_CHUNK);
+			dochunk(current[0], current[1], task);
+
+			t0 = MPI_Wtime();
+			reply.wait();
+			ask.wait();
+			waiting += MPI_Wtime() - t0;
+			std::swap(current, prefetch);
+		}
+	}
+
+public:
+
+	cMpiComm comm;
+	size_t minchunk = 1;
+	size_t maxchunk = 1024;
+	double chunkfactor = 2.0;
+	bool masterworks = true;
+
+	cMpiTaskFarm(const MPI_Comm& _comm){
+		comm.set(_comm);
+	}
+
+	//Collective. Calls task(id) for every id in [0,_ntasks) exactly once on some rank.
+	template < typename F >
+	void run(const size_t _ntasks, F task){
+		ntasks = _ntasks;
+		next = 0;
+		busy = waiting = wall = 0.0;
+		ntasksdone = nchunks = 0;
+
+		const double t0 = MPI_Wtime();
+		if (comm.rank() == 0) runmaster(task);
+		else runworker(task);
+		wall = MPI_Wtime() - t0;
+	}
+
+	//Fraction of this rank's time spent in tasks during the last run()
+	double utilisation() const {
+		return wall > 0.0 ? busy / wall : 0.0;
+	}
+
+	//Collective. Logs tasks, chunks, busy and waiting time and utilisation for each rank, and the overall load imbalance.
+	void report(){
+		std::vector<double> mine = { (double)ntasksdone, (double)nchunks, busy, waiting, wall };
+		std::vector<double> all;
+		comm.gatherv(mine, all, 0);
+		if (comm.rank() != 0) return;
+
+		const size_t n = mine.size();
+		const size_t p = (size_t)comm.size();
+		double sumbusy = 0.0, maxbusy = 0.0, maxwall = 0.0;
+		glog.logmsg("Task farm: %zu tasks on %zu ranks\n", ntasks, p);
+		glog.logmsg("%6s %10s %8s %10s %10s %10s %8s\n", "rank", "tasks", "chunks", "busy(s)", "wait(s)", "wall(s)", "util(%)");
+		for (size_t i = 0; i < p; i++){
+			const double* r = &all[i * n];
+			const double u = r[4] > 0.0 ? 100.0 * r[2] / r[4] : 0.0;
+			glog.logmsg("%6zu %10.0lf %8.0lf %10.3lf %10.3lf %10.3lf %8.1lf\n", i, r[0], r[1], r[2], r[3], r[4], u);
+			sumbusy += r[2];
+			maxbusy = std::max(maxbusy, r[2]);
+			maxwall = std::max(maxwall, r[4]);
+		}
+		const double meanbusy = sumbusy / (double)p;
+		const double imbalance = meanbusy > 0.0 ? maxbusy / meanbusy : 0.0;
+		const double efficiency = maxwall > 0.0 ? 100.0 * sumbusy / (maxwall * (double)p) : 0.0;
+		glog.logmsg("Load imbalance (max/mean busy) %.3lf, parallel efficiency %.1lf%%\n", imbalance, efficiency);
+	}
+};
+
+#endif
@@ -11,12 +11,66 @@ Author: Ross C. Brodie, Geoscience Australia.
 
 #include <stdint.h>
 #include <vector>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
 #include <mpi.h>
 #include <general_utils.h>
 
+//Functions returning a cMpiRequest, whose destructor blocks, warn if the result is discarded
+#if __cplusplus >= 201703L
+#define _MPI_NODISCARD_ [[nodiscard]]
+#elif defined(__GNUC__)
+#define _MPI_NODISCARD_ __attribute__((warn_unused_result))
+#else
+#define _MPI_NODISCARD_
+#endif
 
 class cMpiComm;
 class cMpiEnv;
+class cMpiRequest;
+class cMpiRequestSet;
+class cVec;
+class cPnt;
+struct SampleIndex;
+struct IndexTable;
+
+//Describes the members of a struct for building an MPI datatype, see cMpiStructLayout
+template<typename T>
+class cMpiStructBuilder{
+
+public:
+	std::vector<int> blocklengths;
+	std::vector<MPI_Aint> displacements;
+	std::vector<MPI_Datatype> types;
+
+	//Member pointer, e.g. b.add(&SampleIndex::lineindex)
+	template<typename M>
+	void add(M T::* member);
+
+	//count elements of type M starting at byte offset
+	template<typename M>
+	void add(const size_t offset, const size_t count);
+};
+
+//Specialise this for each struct to be sent as a derived type, giving a static describe(cMpiStructBuilder<T>&).
+//Structs whose members are all the same arithmetic type can derive from cMpiHomogeneousLayout instead.
+template<typename T>
+struct cMpiStructLayout;
+
+template<typename T, typename M>
+struct cMpiHomogeneousLayout{
+	static void describe(cMpiStructBuilder<T>& b){
+		b.template add<M>(0, sizeof(T) / sizeof(M));
+	}
+};
+
+template<> struct cMpiStructLayout<cPoint> : cMpiHomogeneousLayout<cPoint, double>{};
+template<> struct cMpiStructLayout<cVec> : cMpiHomogeneousLayout<cVec, double>{};
+template<> struct cMpiStructLayout<cPnt> : cMpiHomogeneousLayout<cPnt, double>{};
+template<> struct cMpiStructLayout<SampleIndex> : cMpiHomogeneousLayout<SampleIndex, size_t>{};
+template<> struct cMpiStructLayout<IndexTable> : cMpiHomogeneousLayout<IndexTable, size_t>{};
 
 class cMpiEnv{
 
@@ -51,6 +105,9 @@ public:
 
 	void stop(){
 		glog.logmsg(0,"Finalizing MPI\n");
+		std::vector<MPI_Datatype>& d = derivedtypes();
+		for (size_t i = 0; i < d.size(); i++) MPI_Type_free(&d[i]);
+		d.clear();
 		MPI_Finalize();
 	}
 
@@ -79,6 +136,11 @@ public:
 	}
 
 	static MPI_Datatype mpitype(const char& v){ return MPI_CHAR; }
+	static MPI_Datatype mpitype(const unsigned char& v){ return MPI_UNSIGNED_CHAR; }
+	static MPI_Datatype mpitype(const short& v){ return MPI_SHORT; }
+	static MPI_Datatype mpitype(const unsigned int& v){ return MPI_UNSIGNED; }
+	static MPI_Datatype mpitype(const long& v){ return MPI_LONG; }
+	static MPI_Datatype mpitype(const long long& v){ return MPI_LONG_LONG; }
 	static MPI_Datatype mpitype(const size_t& v){ return MPI_UINT64_T; }
 	static MPI_Datatype mpitype(const int& v){ return MPI_INT; }
 	static MPI_Datatype mpitype(const float& v){ return MPI_FLOAT; }
@@ -87,10 +149,37 @@ public:
 	
 	template < typename T >
 	static MPI_Datatype mpitype(const std::vector<T>& v){
-		T dummy;
+		T dummy = T();
 		return mpitype(dummy);
 	}
 
+	//Any other type must have a cMpiStructLayout, its datatype is built and committed once and then cached
+	template < typename T >
+	static MPI_Datatype mpitype(const T& v){
+		static const MPI_Datatype t = committype<T>();
+		return t;
+	}
+
+	//Derived datatypes committed so far, freed by stop()
+	static std::vector<MPI_Datatype>& derivedtypes(){
+		static std::vector<MPI_Datatype> types;
+		return types;
+	}
+
+	template < typename T >
+	static MPI_Datatype committype(){
+		cMpiStructBuilder<T> b;
+		cMpiStructLayout<T>::describe(b);
+		MPI_Datatype st, t;
+		MPI_Type_create_struct((int)b.types.size(), b.blocklengths.data(), b.displacements.data(), b.types.data(), &st);
+		//Extent must be sizeof(T) so arrays of T with trailing padding step correctly
+		MPI_Type_create_resized(st, 0, (MPI_Aint)sizeof(T), &t);
+		MPI_Type_free(&st);
+		MPI_Type_commit(&t);
+		derivedtypes().push_back(t);
+		return t;
+	}
+
 	static bool isinitialised(){
 		int initialised;
 		int ierr = MPI_Initialized(&initialised);
@@ -129,6 +218,209 @@ public:
 
 };
 
+template<typename T>
+template<typename M>
+void cMpiStructBuilder<T>::add(M T::* member){
+	T dummy;
+	const MPI_Aint offset = (MPI_Aint)((const char*)&(dummy.*member) - (const char*)&dummy);
+	add<M>((size_t)offset, 1);
+}
+
+template<typename T>
+template<typename M>
+void cMpiStructBuilder<T>::add(const size_t offset, const size_t count){
+	M dummy = M();
+	blocklengths.push_back((int)count);
+	displacements.push_back((MPI_Aint)offset);
+	types.push_back(cMpiEnv::mpitype(dummy));
+}
+
+//A single non-blocking operation. For sends the data is held in buffer (a copy, or a moved-in vector)
+//until completion, so the caller's variable may go out of scope. For receives the caller's variable
+//must stay alive until the request completes.
+//An incomplete request is waited on when destroyed, so a discarded result (comm.isend(x, dest);) blocks at the
+//end of the statement like a blocking send. Two ranks exchanging large messages that way can deadlock: keep the
+//request, or add it to a cMpiRequestSet, until the matching receive has been posted.
+class cMpiRequest{
+
+public:
+	MPI_Request request = MPI_REQUEST_NULL;
+	MPI_Status status;
+	std::shared_ptr<void> buffer;
+	bool ok = true;//false if posting failed or there was nothing to receive
+
+	cMpiRequest(){ };
+
+	~cMpiRequest(){
+		wait();
+	}
+
+	cMpiRequest(const cMpiRequest&) = delete;
+	cMpiRequest& operator=(const cMpiRequest&) = delete;
+
+	cMpiRequest(cMpiRequest&& b){
+		take(b);
+	}
+
+	cMpiRequest& operator=(cMpiRequest&& b){
+		if (this != &b){
+			wait();
+			take(b);
+		}
+		return *this;
+	}
+
+	explicit operator bool() const {
+		return ok;
+	}
+
+	bool pending() const {
+		return request != MPI_REQUEST_NULL;
+	}
+
+	bool wait(){
+		if (pending() == false) return ok;
+		int ierr = MPI_Wait(&request, &status);
+		buffer.reset();
+		return ok = cMpiEnv::chkerr(ierr);
+	}
+
+	//True when complete
+	bool test(){
+		if (pending() == false) return true;
+		int flag = 0;
+		int ierr = MPI_Test(&request, &flag, &status);
+		ok = cMpiEnv::chkerr(ierr);
+		if (flag) buffer.reset();
+		return flag != 0;
+	}
+
+	//Number of elements received
+	int count(MPI_Datatype datatype) const {
+		int n = 0;
+		MPI_Get_count(&status, datatype, &n);
+		return n;
+	}
+
+private:
+	void take(cMpiRequest& b){
+		request = b.request;
+		status = b.status;
+		buffer = std::move(b.buffer);
+		ok = b.ok;
+		b.request = MPI_REQUEST_NULL;
+	}
+};
+
+//A group of outstanding requests, kept as a plain MPI_Request array so waitall/waitany/testsome are single MPI calls.
+//Send buffers are released as their requests complete. Outstanding requests are waited on when destroyed.
+class cMpiRequestSet{
+
+	std::vector<MPI_Request> requests;
+	std::vector<std::shared_ptr<void>> buffers;
+	std::vector<int> indices;
+	std::vector<MPI_Status> statuses;
+
+	void release(const int i){
+		buffers[(size_t)i].reset();
+	}
+
+public:
+
+	cMpiRequestSet(){ };
+
+	~cMpiRequestSet(){
+		waitall();
+	}
+
+	cMpiRequestSet(const cMpiRequestSet&) = delete;
+	cMpiRequestSet& operator=(const cMpiRequestSet&) = delete;
+
+	//Takes over the request, returns its index in the set
+	size_t add(cMpiRequest&& r){
+		requests.push_back(r.request);
+		buffers.push_back(std::move(r.buffer));
+		r.request = MPI_REQUEST_NULL;
+		return requests.size() - 1;
+	}
+
+	size_t size() const {
+		return requests.size();
+	}
+
+	size_t pending() const {
+		size_t n = 0;
+		for (size_t i = 0; i < requests.size(); i++){
+			if (requests[i] != MPI_REQUEST_NULL) n++;
+		}
+		return n;
+	}
+
+	const MPI_Status& status(const size_t i) const {
+		return statuses[i];
+	}
+
+	bool waitall(){
+		if (requests.size() == 0) return true;
+		statuses.resize(requests.size());
+		int ierr = MPI_Waitall((int)requests.size(), requests.data(), statuses.data());
+		for (size_t i = 0; i < buffers.size(); i++) buffers[i].reset();
+		return cMpiEnv::chkerr(ierr);
+	}
+
+	//Index of a completed request, or -1 if none are outstanding
+	int waitany(){
+		if (requests.size() == 0) return -1;
+		statuses.resize(requests.size());
+		int index = MPI_UNDEFINED;
+		MPI_Status s;
+		int ierr = MPI_Waitany((int)requests.size(), requests.data(), &index, &s);
+		cMpiEnv::chkerr(ierr);
+		if (index == MPI_UNDEFINED) return -1;
+		statuses[(size_t)index] = s;
+		release(index);
+		return index;
+	}
+
+	//Indices of the requests that have completed since the last call, without blocking
+	const std::vector<int>& testsome(){
+		indices.resize(requests.size());
+		statuses.resize(requests.size());
+		std::vector<MPI_Status> s(requests.size());
+		int n = 0;
+		if (requests.size() > 0){
+			int ierr = MPI_Testsome((int)requests.size(), requests.data(), &n, indices.data(), s.data());
+			cMpiEnv::chkerr(ierr);
+			if (n == MPI_UNDEFINED) n = 0;
+		}
+		indices.resize((size_t)n);
+		for (int k = 0; k < n; k++){
+			statuses[(size_t)indices[k]] = s[(size_t)k];
+			release(indices[k]);
+		}
+		return indices;
+	}
+
+	bool testall(){
+		testsome();
+		return pending() == 0;
+	}
+
+	//Gives the MPI library a chance to move outstanding messages along, call this between chunks of computation
+	size_t progress(){
+		return testsome().size();
+	}
+
+	//Waits for everything and empties the set
+	bool clear(){
+		bool status = waitall();
+		requests.clear();
+		buffers.clear();
+		statuses.clear();
+		return status;
+	}
+};
+
 class cMpiComm{
 
 	MPI_Comm comm;
@@ -143,6 +435,14 @@ public:
 		set(_comm);
 	}
 
+	//Collective. New communicator of the ranks sharing this one's node memory, the caller frees it with MPI_Comm_free
+	MPI_Comm splitshared(){
+		MPI_Comm node;
+		int ierr = MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank(), MPI_INFO_NULL, &node);
+		chkerr(ierr);
+		return node;
+	}
+
 	operator const MPI_Comm& ()
 	{		
 		return comm;
@@ -218,86 +518,286 @@ public:
 	};
 
 	bool bcast(std::string& s, int root = 0){
-		std::vector<char> buf(s.begin(), s.end());		
-		bool status = bcast(buf, root);
-		if (rank() != root){
-			buf.push_back(0);
-			s = std::string(buf.data());
-		}
-		return status;
+		size_t n = s.size();
+		bcast(n, root);
+		s.resize(n);
+		if (n == 0) return true;
+		int ierr = MPI_Bcast(&s[0], (int)n, MPI_CHAR, root, comm);
+		return chkerr(ierr);
 	};
 
 	template < typename T >
-	bool isend(T& value, int destination){				
-		MPI_Request request;
-		int tag = 0;
-		int ierr = MPI_Isend(&value, 1, cMpiEnv::mpitype(value), destination, tag, comm, &request);
-		return chkerr(ierr);
+	_MPI_NODISCARD_ cMpiRequest isend(const T& value, int destination, int tag = 0){
+		cMpiRequest r;
+		std::shared_ptr<T> b = std::make_shared<T>(value);
+		r.buffer = b;
+		int ierr = MPI_Isend(b.get(), 1, cMpiEnv::mpitype(value), destination, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
 	};
 
 	template < typename T >
-	bool isend_vec(std::vector<T>& v, int destination){		
-		MPI_Request request;
-		int tag = 0;
-		int ierr = MPI_Isend(v.data(), (int)v.size(), cMpiEnv::mpitype(v), destination, tag, comm, &request);
-		return chkerr(ierr);
+	_MPI_NODISCARD_ cMpiRequest isend_vec(const std::vector<T>& v, int destination, int tag = 0){
+		return isend_vec(std::vector<T>(v), destination, tag);
 	};
 
-	bool isend_str(const std::string& s, int destination){				
-		MPI_Request request;
-		int tag = 0;
-		int ierr = MPI_Isend((void*)s.data(), (int)s.size(), cMpiEnv::mpitype(s), destination, tag, comm, &request);
-		return chkerr(ierr);
+	//Moves the vector into the request rather than copying it
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest isend_vec(std::vector<T>&& v, int destination, int tag = 0){
+		cMpiRequest r;
+		std::shared_ptr<std::vector<T>> b = std::make_shared<std::vector<T>>(std::move(v));
+		r.buffer = b;
+		int ierr = MPI_Isend(b->data(), (int)b->size(), cMpiEnv::mpitype(*b), destination, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
 	};
-	
+
+	_MPI_NODISCARD_ cMpiRequest isend_str(const std::string& s, int destination, int tag = 0){
+		cMpiRequest r;
+		std::shared_ptr<std::string> b = std::make_shared<std::string>(s);
+		r.buffer = b;
+		int ierr = MPI_Isend((void*)b->data(), (int)b->size(), cMpiEnv::mpitype(s), destination, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
 	template < typename T >
-	bool irecv(T& value, int source){
-		MPI_Request request;
-		int tag = 0;
-		int ierr = MPI_Irecv(&value, 1, cMpiEnv::mpitype(value), source, tag, comm, &request);
-		return chkerr(ierr);
+	_MPI_NODISCARD_ cMpiRequest irecv(T& value, int source, int tag = 0){
+		cMpiRequest r;
+		int ierr = MPI_Irecv(&value, 1, cMpiEnv::mpitype(value), source, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
 	};
 
+	//Receive into a vector already sized to the expected count
 	template < typename T >
-	bool irecv_vec(std::vector<T>& v, int source){				
+	_MPI_NODISCARD_ cMpiRequest irecv_into(std::vector<T>& v, int source, int tag = 0){
+		cMpiRequest r;
+		int ierr = MPI_Irecv(v.data(), (int)v.size(), cMpiEnv::mpitype(v), source, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	//Receive a message of unknown length if one has arrived, otherwise v is emptied and the request is false
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest irecv_vec(std::vector<T>& v, int source, int tag = 0){
+		cMpiRequest r;
 		MPI_Status status;
 		int flag;
-		MPI_Request request;
-		int tag = 0;
 		int n;
 		int ierr;
 		
 		ierr = MPI_Iprobe(source, tag, comm, &flag, &status);
 		if (flag == 0){
 			v.resize(0);
-			return false;
+			r.ok = false;
+			return r;
 		}
 
 		ierr = MPI_Get_count(&status, cMpiEnv::mpitype(v), &n);
 		v.resize(n);
-		ierr = MPI_Irecv(v.data(), n, cMpiEnv::mpitype(v), source, tag, comm, &request);
-		return chkerr(ierr);
+		ierr = MPI_Irecv(v.data(), n, cMpiEnv::mpitype(v), status.MPI_SOURCE, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
 	};
 	
-	bool irecv_str(std::string& s, int source){		
+	_MPI_NODISCARD_ cMpiRequest irecv_str(std::string& s, int source, int tag = 0){
+		cMpiRequest r;
 		MPI_Status status;
 		int flag;
-		MPI_Request request;
-		int tag = 0;
 		int count = 1;
 		int ierr;
 		ierr = MPI_Iprobe(source, tag, comm, &flag, &status);
 		if (flag == 0){
 			s.resize(0);
-			return false;
+			r.ok = false;
+			return r;
 		}
 
 		ierr = MPI_Get_count(&status, cMpiEnv::mpitype(s), &count);		
 		s.resize(count);
-		ierr = MPI_Irecv((void*)s.data(), count, cMpiEnv::mpitype(s), source, tag, comm, &request);
+		ierr = MPI_Irecv((void*)s.data(), count, cMpiEnv::mpitype(s), status.MPI_SOURCE, tag, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	//Overlap communication with computation: calls work(i) for i in [0,nchunks) while driving the
+	//outstanding requests along in between, then waits for whatever is left.
+	//e.g. post halo exchange irecv/isend into the set, compute the interior here, then use the halo.
+	template < typename F >
+	bool overlap(cMpiRequestSet& requests, const size_t nchunks, F work){
+		for (size_t i = 0; i < nchunks; i++){
+			work(i);
+			requests.progress();
+		}
+		return requests.waitall();
+	};
+
+	//Displacements for counts laid end to end
+	static std::vector<int> displacements(const std::vector<int>& counts){
+		std::vector<int> d(counts.size(), 0);
+		for (size_t i = 1; i < counts.size(); i++) d[i] = d[i - 1] + counts[i - 1];
+		return d;
+	}
+
+	static int total(const std::vector<int>& counts){
+		int n = 0;
+		for (size_t i = 0; i < counts.size(); i++) n += counts[i];
+		return n;
+	}
+
+	template < typename T >
+	T allreduce(const T& value, MPI_Op op = MPI_SUM){
+		T r;
+		int ierr = MPI_Allreduce(&value, &r, 1, cMpiEnv::mpitype(value), op, comm);
+		chkerr(ierr);
+		return r;
+	};
+
+	//Element-wise, in place
+	template < typename T >
+	bool allreduce(std::vector<T>& v, MPI_Op op = MPI_SUM){
+		int ierr = MPI_Allreduce(MPI_IN_PLACE, v.data(), (int)v.size(), cMpiEnv::mpitype(v), op, comm);
+		return chkerr(ierr);
+	};
+
+	//Concatenate every rank's vector in rank order on root, counts (on root) gets each rank's length
+	template < typename T >
+	bool gatherv(const std::vector<T>& send, std::vector<T>& recv, std::vector<int>& counts, int root = 0){
+		int n = (int)send.size();
+		counts.resize(size());
+		int ierr = MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+		chkerr(ierr);
+		std::vector<int> displs = displacements(counts);
+		if (rank() == root) recv.resize((size_t)total(counts));
+		ierr = MPI_Gatherv(send.data(), n, cMpiEnv::mpitype(send), recv.data(), counts.data(), displs.data(), cMpiEnv::mpitype(recv), root, comm);
+		return chkerr(ierr);
+	};
+
+	template < typename T >
+	bool gatherv(const std::vector<T>& send, std::vector<T>& recv, int root = 0){
+		std::vector<int> counts;
+		return gatherv(send, recv, counts, root);
+	};
+
+	//Root sends counts[i] consecutive elements of send to rank i
+	template < typename T >
+	bool scatterv(const std::vector<T>& send, const std::vector<int>& counts, std::vector<T>& recv, int root = 0){
+		int n = 0;
+		int ierr = MPI_Scatter(counts.data(), 1, MPI_INT, &n, 1, MPI_INT, root, comm);
+		chkerr(ierr);
+		std::vector<int> displs;
+		if (rank() == root) displs = displacements(counts);
+		recv.resize((size_t)n);
+		ierr = MPI_Scatterv(send.data(), counts.data(), displs.data(), cMpiEnv::mpitype(send), recv.data(), n, cMpiEnv::mpitype(recv), root, comm);
+		return chkerr(ierr);
+	};
+
+	template < typename T >
+	bool allgatherv(const std::vector<T>& send, std::vector<T>& recv, std::vector<int>& counts){
+		int n = (int)send.size();
+		counts.resize(size());
+		int ierr = MPI_Allgather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+		chkerr(ierr);
+		std::vector<int> displs = displacements(counts);
+		recv.resize((size_t)total(counts));
+		ierr = MPI_Allgatherv(send.data(), n, cMpiEnv::mpitype(send), recv.data(), counts.data(), displs.data(), cMpiEnv::mpitype(recv), comm);
+		return chkerr(ierr);
+	};
+
+	template < typename T >
+	bool allgatherv(const std::vector<T>& send, std::vector<T>& recv){
+		std::vector<int> counts;
+		return allgatherv(send, recv, counts);
+	};
+
+	//send holds sendcounts[i] consecutive elements for rank i, recv gets recvcounts[i] from rank i in rank order
+	template < typename T >
+	bool alltoallv(const std::vector<T>& send, const std::vector<int>& sendcounts, std::vector<T>& recv, std::vector<int>& recvcounts){
+		recvcounts.resize(size());
+		int ierr = MPI_Alltoall(sendcounts.data(), 1, MPI_INT, recvcounts.data(), 1, MPI_INT, comm);
+		chkerr(ierr);
+		std::vector<int> sdispls = displacements(sendcounts);
+		std::vector<int> rdispls = displacements(recvcounts);
+		recv.resize((size_t)total(recvcounts));
+		ierr = MPI_Alltoallv(send.data(), sendcounts.data(), sdispls.data(), cMpiEnv::mpitype(send), recv.data(), recvcounts.data(), rdispls.data(), cMpiEnv::mpitype(recv), comm);
 		return chkerr(ierr);
 	};
 
+	//Non-blocking versions. Counts must already be known on the receiving side (use the blocking
+	//forms or a count exchange first); recv is sized here and must stay alive until the request completes.
+	//The count and displacement arrays are held by the request.
+
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest iallreduce(std::vector<T>& v, MPI_Op op = MPI_SUM){
+		cMpiRequest r;
+		int ierr = MPI_Iallreduce(MPI_IN_PLACE, v.data(), (int)v.size(), cMpiEnv::mpitype(v), op, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest igatherv(const std::vector<T>& send, std::vector<T>& recv, const std::vector<int>& counts, int root = 0){
+		cMpiRequest r;
+		std::shared_ptr<std::vector<int>> a = std::make_shared<std::vector<int>>(counts);
+		a->resize(2 * counts.size());
+		std::vector<int> d = displacements(counts);
+		std::copy(d.begin(), d.end(), a->begin() + counts.size());
+		r.buffer = a;
+		if (rank() == root) recv.resize((size_t)total(counts));
+		int ierr = MPI_Igatherv(send.data(), (int)send.size(), cMpiEnv::mpitype(send), recv.data(), a->data(), a->data() + counts.size(), cMpiEnv::mpitype(recv), root, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	//n is the number of elements this rank receives
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest iscatterv(const std::vector<T>& send, const std::vector<int>& counts, std::vector<T>& recv, const int n, int root = 0){
+		cMpiRequest r;
+		std::shared_ptr<std::vector<int>> a = std::make_shared<std::vector<int>>(counts);
+		a->resize(2 * counts.size());
+		std::vector<int> d = displacements(counts);
+		std::copy(d.begin(), d.end(), a->begin() + counts.size());
+		r.buffer = a;
+		recv.resize((size_t)n);
+		int ierr = MPI_Iscatterv(send.data(), a->data(), a->data() + counts.size(), cMpiEnv::mpitype(send), recv.data(), n, cMpiEnv::mpitype(recv), root, comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest iallgatherv(const std::vector<T>& send, std::vector<T>& recv, const std::vector<int>& counts){
+		cMpiRequest r;
+		std::shared_ptr<std::vector<int>> a = std::make_shared<std::vector<int>>(counts);
+		a->resize(2 * counts.size());
+		std::vector<int> d = displacements(counts);
+		std::copy(d.begin(), d.end(), a->begin() + counts.size());
+		r.buffer = a;
+		recv.resize((size_t)total(counts));
+		int ierr = MPI_Iallgatherv(send.data(), (int)send.size(), cMpiEnv::mpitype(send), recv.data(), a->data(), a->data() + counts.size(), cMpiEnv::mpitype(recv), comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
+	template < typename T >
+	_MPI_NODISCARD_ cMpiRequest ialltoallv(const std::vector<T>& send, const std::vector<int>& sendcounts, std::vector<T>& recv, const std::vector<int>& recvcounts){
+		cMpiRequest r;
+		const size_t p = sendcounts.size();
+		std::shared_ptr<std::vector<int>> a = std::make_shared<std::vector<int>>(4 * p);
+		std::vector<int> sd = displacements(sendcounts);
+		std::vector<int> rd = displacements(recvcounts);
+		std::copy(sendcounts.begin(), sendcounts.end(), a->begin());
+		std::copy(sd.begin(), sd.end(), a->begin() + p);
+		std::copy(recvcounts.begin(), recvcounts.end(), a->begin() + 2 * p);
+		std::copy(rd.begin(), rd.end(), a->begin() + 3 * p);
+		r.buffer = a;
+		recv.resize((size_t)total(recvcounts));
+		int* q = a->data();
+		int ierr = MPI_Ialltoallv(send.data(), q, q + p, cMpiEnv::mpitype(send), recv.data(), q + 2 * p, q + 3 * p, cMpiEnv::mpitype(recv), comm, &r.request);
+		r.ok = chkerr(ierr);
+		return r;
+	};
+
 	template < typename T >
 	T sum(T& value){
 		T s;
@@ -311,7 +811,110 @@ public:
 		return (double)sum(value)/size();
 	};
 
+	//Combine a mergeable accumulator (cRunningStats, cStreamingHistogram, cQuantileSketch) across all ranks.
+	//Every rank ends up with the same result, merged in rank order so it is reproducible.
+	template < typename T >
+	void allmerge(T& accumulator){
+		std::vector<double> all;
+		std::vector<int> counts;
+		allgatherv(accumulator.serialise(), all, counts);
+		std::vector<int> displs = displacements(counts);
+
+		T merged = accumulator;
+		merged.reset();
+		for (int i = 0; i < size(); i++){
+			if (i == rank()) merged.merge(accumulator);
+			else merged.merge_serialised(&all[(size_t)displs[i]]);
+		}
+		accumulator = merged;
+	};
+
 };
 
-#endif
+//A read-only array held once per node in MPI shared memory (MPI_Win_allocate_shared) rather than once per rank.
+//Construction is collective over comm. The first rank on each node (loader()) allocates and fills the array,
+//then calls publish(), which is collective on the node; after that every rank on the node reads it zero-copy
+//through view(). The size is taken from the loader, so other ranks may pass 0.
+template<typename T>
+class cMpiSharedArray{
+
+	MPI_Comm nodecomm = MPI_COMM_NULL;
+	MPI_Win win = MPI_WIN_NULL;
+	T* p = nullptr;
+	size_t n = 0;
+	int noderank = 0;
+
+public:
+
+	cMpiSharedArray(const MPI_Comm& comm, const size_t count){
+		cMpiComm c(comm);
+		nodecomm = c.splitshared();
+		cMpiComm node(nodecomm);
+		noderank = node.rank();
+		n = count;
+		node.bcast(n, 0);
+
+		const MPI_Aint bytes = noderank == 0 ? (MPI_Aint)(n * sizeof(T)) : 0;
+		void* base = nullptr;
+		int ierr = MPI_Win_allocate_shared(bytes, (int)sizeof(T), MPI_INFO_NULL, nodecomm, &base, &win);
+		node.chkerr(ierr);
+
+		MPI_Aint size;
+		int dispunit;
+		ierr = MPI_Win_shared_query(win, 0, &size, &dispunit, &base);
+		node.chkerr(ierr);
+		p = static_cast<T*>(base);
+
+		//Passive target epoch for the lifetime of the window, synchronised with MPI_Win_sync and barriers
+		MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+	}
+
+	~cMpiSharedArray(){
+		if (win != MPI_WIN_NULL){
+			MPI_Win_unlock_all(win);
+			MPI_Win_free(&win);
+		}
+		if (nodecomm != MPI_COMM_NULL) MPI_Comm_free(&nodecomm);
+	}
+
+	cMpiSharedArray(const cMpiSharedArray&) = delete;
+	cMpiSharedArray& operator=(const cMpiSharedArray&) = delete;
+
+	//True on the rank that fills the array on this node
+	bool loader() const {
+		return noderank == 0;
+	}
 
+	size_t size() const {
+		return n;
+	}
+
+	//Writable only on the loader before publish()
+	T* data(){
+		return p;
+	}
+
+	//Collective on the node. Makes the loader's writes visible to the other ranks.
+	void publish(){
+		MPI_Win_sync(win);
+		MPI_Barrier(nodecomm);
+		MPI_Win_sync(win);
+	}
+
+	//Collective on the node. The loader copies v into the array, then it is published.
+	//Only the loader's v is used. If its size is wrong every rank on the node throws, so none is left in publish().
+	void assign(const std::vector<T>& v){
+		int bad = loader() && v.size() != n ? 1 : 0;
+		cMpiComm node(nodecomm);
+		node.bcast(bad, 0);
+		if (bad) throw(std::runtime_error(strprint("cMpiSharedArray::assign loader size does not match %zu", n)));
+		if (loader()) std::copy(v.begin(), v.end(), p);
+		publish();
+	}
+
+	cSpan<const T> view() const {
+		return cSpan<const T>(p, n);
+	}
+};
+
+#endif
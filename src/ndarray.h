@@ -93,7 +93,7 @@ public:
 
 	size_t  nhigherdims() const {
 		_GSTITEM_		
-		return 1 + higher_dims[0].nhigherdims();
+		return 1 + hdims[0].nhigherdims();
 	}
 
 	std::vector<size_t>  get_dims() const {
@@ -150,7 +150,7 @@ public:
 	void printf(const char* fmt){
 		_GSTITEM_
 		for (size_t i = 0; i < size(); i++){
-			higher_dims[i].printf(fmt);
+			hdims[i].printf(fmt);
 		}
 		std::printf("\n");		
 	}
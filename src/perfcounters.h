@@ -0,0 +1,146 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _perfcounters_H
+#define _perfcounters_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+	#include <unistd.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <linux/perf_event.h>
+#endif
+
+//Hardware counter values, either running totals or the difference between two readings
+class cPerfCounts{
+
+public:
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint64_t cachemisses = 0;
+	uint64_t branchmisses = 0;
+
+	cPerfCounts operator-(const cPerfCounts& b) const {
+		cPerfCounts d;
+		d.cycles = cycles - b.cycles;
+		d.instructions = instructions - b.instructions;
+		d.cachemisses = cachemisses - b.cachemisses;
+		d.branchmisses = branchmisses - b.branchmisses;
+		return d;
+	}
+
+	cPerfCounts& operator+=(const cPerfCounts& b){
+		cycles += b.cycles;
+		instructions += b.instructions;
+		cachemisses += b.cachemisses;
+		branchmisses += b.branchmisses;
+		return *this;
+	}
+
+	double ipc() const {
+		return cycles > 0 ? (double)instructions / (double)cycles : 0.0;
+	}
+};
+
+//A perf_event_open counter group (cycles, instructions, cache misses, branch misses) for the calling thread.
+//If perf events are not permitted (e.g. perf_event_paranoid, containers) or not Linux, available() is false
+//and read() returns false so callers degrade to timing only.
+class cPerfCounterGroup{
+
+private:
+	enum { NCOUNTERS = 4 };
+	int fd[NCOUNTERS];
+	bool isavailable = false;
+
+#if defined(__linux__)
+	static int open_counter(const uint32_t type, const uint64_t config, const int groupfd){
+		struct perf_event_attr pe;
+		memset(&pe, 0, sizeof(pe));
+		pe.type = type;
+		pe.size = sizeof(pe);
+		pe.config = config;
+		pe.disabled = groupfd == -1 ? 1 : 0;
+		pe.exclude_kernel = 1;
+		pe.exclude_hv = 1;
+		pe.read_format = PERF_FORMAT_GROUP;
+		return (int)syscall(__NR_perf_event_open, &pe, 0, -1, groupfd, 0);
+	}
+#endif
+
+public:
+
+	cPerfCounterGroup(){
+		for (int i = 0; i < NCOUNTERS; i++) fd[i] = -1;
+	}
+
+	~cPerfCounterGroup(){
+		close();
+	}
+
+	cPerfCounterGroup(const cPerfCounterGroup&) = delete;
+	cPerfCounterGroup& operator=(const cPerfCounterGroup&) = delete;
+
+	bool open(){
+	#if defined(__linux__)
+		if (isavailable) return true;
+		fd[0] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+		if (fd[0] < 0) return false;
+		fd[1] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fd[0]);
+		fd[2] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fd[0]);
+		fd[3] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fd[0]);
+		for (int i = 1; i < NCOUNTERS; i++){
+			if (fd[i] < 0){
+				close();
+				return false;
+			}
+		}
+		ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		isavailable = true;
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+	void close(){
+	#if defined(__linux__)
+		for (int i = NCOUNTERS - 1; i >= 0; i--){
+			if (fd[i] >= 0) ::close(fd[i]);
+			fd[i] = -1;
+		}
+	#endif
+		isavailable = false;
+	}
+
+	bool available() const {
+		return isavailable;
+	}
+
+	//Running totals since open(), one read() syscall for the whole group. False (and c unchanged) if the
+	//counters are unavailable or the read failed, so a failed reading is never differenced.
+	bool read(cPerfCounts& c) const {
+	#if defined(__linux__)
+		if (isavailable == false) return false;
+		uint64_t buf[1 + NCOUNTERS];
+		if (::read(fd[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) return false;
+		c.cycles = buf[1];
+		c.instructions = buf[2];
+		c.cachemisses = buf[3];
+		c.branchmisses = buf[4];
+		return true;
+	#else
+		return false;
+	#endif
+	}
+};
+
+#endif
@@ -10,12 +10,17 @@ Author: Ross C. Brodie, Geoscience Australia.
 #define _petsc_wrapper_H
 
 #include <inttypes.h>
+#include <functional>
+#include <type_traits>
+#include <Eigen/Dense>
 #include "petscvec.h"
 #include "petscmat.h"
 #include "petscksp.h"
 
 #include "file_utils.h"
 #include "general_utils.h"
+#include "blocklanguage.h"
+#include "mpi_wrapper.h"
 
 class cOwnership;//forward declaration only
 class cPetscDistVector;//forward declaration only
@@ -212,6 +217,144 @@ public:
 
 
 
+//Zero copy access to the locally owned entries of a PETSc vector, restored when the view goes out of scope.
+//While a view exists the vector must not be used in other PETSc operations.
+class cPetscDistVectorReadView{
+
+	Vec v = PETSC_NULL;
+	const double* p = PETSC_NULL;
+	size_t n = 0;
+
+public:
+
+	cPetscDistVectorReadView(const Vec& _v){
+		PetscInt nl;
+		PetscErrorCode ierr = VecGetLocalSize(_v, &nl); CHKERR(ierr);
+		ierr = VecGetArrayRead(_v, &p); CHKERR(ierr);
+		v = _v;
+		n = (size_t)nl;
+	}
+
+	cPetscDistVectorReadView(const cPetscDistVector& v);
+
+	cPetscDistVectorReadView(cPetscDistVectorReadView&& rhs){
+		std::swap(v, rhs.v);
+		std::swap(p, rhs.p);
+		std::swap(n, rhs.n);
+	}
+
+	~cPetscDistVectorReadView(){
+		if (v){
+			PetscErrorCode ierr = VecRestoreArrayRead(v, &p); CHKERR(ierr);
+		}
+	}
+
+	cPetscDistVectorReadView(const cPetscDistVectorReadView&) = delete;
+	cPetscDistVectorReadView& operator=(const cPetscDistVectorReadView&) = delete;
+
+	size_t size() const { return n; }
+	const double* data() const { return p; }
+	const double* begin() const { return p; }
+	const double* end() const { return p + n; }
+	const double& operator[](const size_t i) const { return p[i]; }
+
+	cSpan<const double> span() const { return cSpan<const double>(p, n); }
+	Eigen::Map<const Eigen::VectorXd> eigen() const { return Eigen::Map<const Eigen::VectorXd>(p, (Eigen::Index)n); }
+	std::vector<double> tovector() const { return std::vector<double>(p, p + n); }
+};
+
+class cPetscDistVectorLocalView{
+
+	Vec v = PETSC_NULL;
+	double* p = PETSC_NULL;
+	size_t n = 0;
+
+public:
+
+	cPetscDistVectorLocalView(Vec& _v){
+		PetscInt nl;
+		PetscErrorCode ierr = VecGetLocalSize(_v, &nl); CHKERR(ierr);
+		ierr = VecGetArray(_v, &p); CHKERR(ierr);
+		v = _v;
+		n = (size_t)nl;
+	}
+
+	cPetscDistVectorLocalView(cPetscDistVector& v);
+
+	cPetscDistVectorLocalView(cPetscDistVectorLocalView&& rhs){
+		std::swap(v, rhs.v);
+		std::swap(p, rhs.p);
+		std::swap(n, rhs.n);
+	}
+
+	~cPetscDistVectorLocalView(){
+		if (v){
+			PetscErrorCode ierr = VecRestoreArray(v, &p); CHKERR(ierr);
+		}
+	}
+
+	cPetscDistVectorLocalView(const cPetscDistVectorLocalView&) = delete;
+	cPetscDistVectorLocalView& operator=(const cPetscDistVectorLocalView&) = delete;
+
+	size_t size() const { return n; }
+	double* data() const { return p; }
+	double* begin() const { return p; }
+	double* end() const { return p + n; }
+	double& operator[](const size_t i) const { return p[i]; }
+
+	cSpan<double> span() const { return cSpan<double>(p, n); }
+	Eigen::Map<Eigen::VectorXd> eigen() const { return Eigen::Map<Eigen::VectorXd>(p, (Eigen::Index)n); }
+};
+
+//Read only view of a ghosted vector's local form: the owned entries followed by the ghost entries,
+//as current as the last ghostupdate(). On a vector without ghosts it is the same as cPetscDistVectorReadView.
+class cPetscDistVectorGhostView{
+
+	Vec v = PETSC_NULL;
+	Vec lf = PETSC_NULL;
+	const double* p = PETSC_NULL;
+	size_t n = 0;
+	size_t nowned = 0;
+
+public:
+
+	cPetscDistVectorGhostView(const Vec& _v){
+		PetscInt no, nl;
+		v = _v;
+		PetscErrorCode ierr = VecGetLocalSize(v, &no); CHKERR(ierr);
+		ierr = VecGhostGetLocalForm(v, &lf); CHKERR(ierr);
+		const Vec& a = lf ? lf : v;
+		ierr = VecGetLocalSize(a, &nl); CHKERR(ierr);
+		ierr = VecGetArrayRead(a, &p); CHKERR(ierr);
+		nowned = (size_t)no;
+		n = (size_t)nl;
+	}
+
+	cPetscDistVectorGhostView(const cPetscDistVector& v);
+
+	~cPetscDistVectorGhostView(){
+		PetscErrorCode ierr;
+		if (lf){
+			ierr = VecRestoreArrayRead(lf, &p); CHKERR(ierr);
+			ierr = VecGhostRestoreLocalForm(v, &lf); CHKERR(ierr);
+		}
+		else{
+			ierr = VecRestoreArrayRead(v, &p); CHKERR(ierr);
+		}
+	}
+
+	cPetscDistVectorGhostView(const cPetscDistVectorGhostView&) = delete;
+	cPetscDistVectorGhostView& operator=(const cPetscDistVectorGhostView&) = delete;
+
+	size_t size() const { return n; }
+	size_t nlocal() const { return nowned; }
+	size_t nghosts() const { return n - nowned; }
+	const double* data() const { return p; }
+	const double& operator[](const size_t i) const { return p[i]; }
+	cSpan<const double> span() const { return cSpan<const double>(p, n); }
+	cSpan<const double> ghosts() const { return cSpan<const double>(p + nowned, n - nowned); }
+};
+
 class cPetscDistVector : public cPetscObject {
 
 	friend class cPetscDistMatrix;
@@ -310,6 +453,13 @@ public:
 		else return false;
 	}
 
+	void checkallocated() const {
+		if (allocated() == false){
+			PetscPrintf(mpicomm(), "Error cPetscDistVector (%s) attempting to access NULL vec() pointer\n", cname());
+			throw(strprint("Error: exception throw from %s (%d) %s\n", __FILE__, __LINE__, __FUNCTION__));
+		}
+	}
+
 	void create(const MPI_Comm comm, const PetscInt _localsize, const PetscInt _globalsize)
 	{				
 		pVec = new Vec;
@@ -329,6 +479,42 @@ public:
 		set(value);		
 	}
 
+	//Vector that also holds local copies of the entries with the given global indices owned by other ranks
+	void create_ghosted(const std::string& inname, const MPI_Comm comm, const PetscInt _localsize, const PetscInt _globalsize, const std::vector<PetscInt>& ghostindices)
+	{
+		pVec = new Vec;
+		PetscErrorCode ierr = VecCreateGhost(comm, _localsize, _globalsize, (PetscInt)ghostindices.size(), ghostindices.data(), ncvecptr()); CHKERR(ierr);
+		setname(inname);
+	}
+
+	//Collective, copies owned values into the other ranks' ghost entries
+	void ghostupdate()
+	{
+		PetscErrorCode ierr;
+		ierr = VecGhostUpdateBegin(vec(), INSERT_VALUES, SCATTER_FORWARD); CHKERR(ierr);
+		ierr = VecGhostUpdateEnd(vec(), INSERT_VALUES, SCATTER_FORWARD); CHKERR(ierr);
+	}
+
+	//Collective, adds ghost entries into their owners' values
+	void ghostaccumulate()
+	{
+		PetscErrorCode ierr;
+		ierr = VecGhostUpdateBegin(vec(), ADD_VALUES, SCATTER_REVERSE); CHKERR(ierr);
+		ierr = VecGhostUpdateEnd(vec(), ADD_VALUES, SCATTER_REVERSE); CHKERR(ierr);
+	}
+
+	cPetscDistVectorReadView readview() const
+	{
+		checkallocated();
+		return cPetscDistVectorReadView(vec());
+	}
+
+	cPetscDistVectorLocalView localview()
+	{
+		checkallocated();
+		return cPetscDistVectorLocalView(ncvec());
+	}
+
 	cOwnership ownership() const
 	{
 		PetscInt start;
@@ -396,27 +582,49 @@ public:
 		return;
 	}
 
-	void set_local(const std::vector<double>& v)
+	//Any contiguous container with data() and size() holding the local entries, e.g. std::vector or Eigen vectors.
+	//For a raw pointer use set_local_from().
+	template < typename C, typename = typename std::enable_if<!std::is_pointer<C>::value>::type >
+	void set_local(const C& v)
 	{
-		double* a = getlocalarray();
-		for (PetscInt i = 0; i<localsize(); ++i){
-			a[i] = v[i];
+		set_local_from(v.data(), (size_t)v.size());
+	}
+
+	//n local entries from a raw array
+	void set_local_from(const double* v, const size_t n)
+	{
+		cPetscDistVectorLocalView a = localview();
+		if (n != a.size()){
+			PetscPrintf(mpicomm(), "Error cPetscDistVector::set_local_from() (%s) size %zu does not match local size %zu\n", cname(), n, a.size());
+			throw(strprint("Error: exception throw from %s (%d) %s\n", __FILE__, __LINE__, __FUNCTION__));
 		}
-		restorelocalarray(a);
+		std::copy(v, v + n, a.data());
+	}
+
+	std::vector<double> get_local() const
+	{
+		return readview().tovector();
+	}
+
+	void get_local(std::vector<double>& v) const
+	{
+		cPetscDistVectorReadView a = readview();
+		v.assign(a.begin(), a.end());
+	}
+
+	Eigen::VectorXd get_local_eigen() const
+	{
+		return readview().eigen();
 	}
 
 	std::vector<double> getglobal() const
 	{
-		std::vector<double> v(globalsize());
-		double* a;
 		VecScatter ctx;
 		Vec V_SEQ;
 		VecScatterCreateToAll(vec(), &ctx, &V_SEQ);
 		VecScatterBegin(ctx, vec(), V_SEQ, INSERT_VALUES, SCATTER_FORWARD);
 		VecScatterEnd(ctx, vec(), V_SEQ, INSERT_VALUES, SCATTER_FORWARD);
-		VecGetArray(V_SEQ, &a);
-		for (size_t i = 0; i<(size_t)globalsize(); i++) v[i] = a[i];
-		VecRestoreArray(V_SEQ, &a);
+		std::vector<double> v = cPetscDistVectorReadView(V_SEQ).tovector();
 		VecScatterDestroy(&ctx);
 		VecDestroy(&V_SEQ);
 		return v;
@@ -445,7 +653,7 @@ public:
 
 	friend double dot(const cPetscDistVector& v1, const cPetscDistVector& v2);
 	friend cPetscDistVector normalized_residual(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev);
-	friend double data_misfit(const cPetscDistVector& v0, cPetscDistVector& v, const cPetscDistVector& ev);
+	friend double data_misfit(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev);
 	friend double data_misfit_normalized(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev);
 
 
@@ -494,9 +702,9 @@ public:
 			mpibarrier();
 		}
 	}
-	void printvalues(const std::string& format)
+	void printvalues(const std::string& format) const
 	{
-		double* a = getlocalarray();
+		cPetscDistVectorReadView a = readview();
 		for (int p = 0; p < mpisize(); p++){
 			mpibarrier();
 			if (p == mpirank()){
@@ -512,12 +720,11 @@ public:
 			}
 			mpibarrier();
 		}
-		restorelocalarray(a);
 		mpibarrier();
 	}
-	void writetextfile(const std::string& filename)
+	void writetextfile(const std::string& filename) const
 	{
-		double* a = getlocalarray();
+		cPetscDistVectorReadView a = readview();
 		for (int p = 0; p < mpisize(); p++){
 			mpibarrier();
 			if (p == mpirank()){
@@ -537,7 +744,6 @@ public:
 			}
 			mpibarrier();
 		}
-		restorelocalarray(a);
 		mpibarrier();
 	}
 
@@ -599,12 +805,7 @@ public:
 
 	cPetscDistVector& operator+=(const double& value)
 	{
-		double* a = getlocalarray();
-		cOwnership r = ownership();
-		for (PetscInt i = 0; i<r.nlocal(); ++i){
-			a[i] += value;
-		}
-		restorelocalarray(a);
+		PetscErrorCode ierr = VecShift(vec(), value); CHKERR(ierr);
 		return *this;
 	}
 
@@ -653,38 +854,292 @@ public:
 	}
 	
 	void pow(const double& p)
-	{		
-		double* v = getlocalarray();		
-		for (size_t i = 0; i < (size_t)localsize(); i++){
-			v[i] = std::pow(v[i],p);
-		}
-		restorelocalarray(v);
-		return;
+	{
+		cPetscDistVectorLocalView v = localview();
+		for (double& x : v) x = std::pow(x, p);
 	}
 		
 };
 
-class cPetscDistVectorLocalView{
+inline cPetscDistVectorReadView::cPetscDistVectorReadView(const cPetscDistVector& v) : cPetscDistVectorReadView(v.vec()){ }
 
-private:
-	cPetscDistVector* pv;
-	double* data;
+inline cPetscDistVectorLocalView::cPetscDistVectorLocalView(cPetscDistVector& v) : cPetscDistVectorLocalView(v.ncvec()){ }
+
+inline cPetscDistVectorGhostView::cPetscDistVectorGhostView(const cPetscDistVector& v) : cPetscDistVectorGhostView(v.vec()){ }
+
+inline double dot(const cPetscDistVector& v1, const cPetscDistVector& v2)
+{
+	return v1.dot(v2);
+}
+
+//(v-v0)/ev elementwise
+inline cPetscDistVector normalized_residual(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev)
+{
+	cPetscDistVector r(v);
+	{
+		cPetscDistVectorReadView a0(v0), a(v), e(ev);
+		cPetscDistVectorLocalView b(r);
+		for (size_t i = 0; i < b.size(); i++) b[i] = (a[i] - a0[i]) / e[i];
+	}
+	return r;
+}
+
+//Sum of squared normalised residuals in one pass over the local arrays, without forming the residual vector
+inline double data_misfit(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev)
+{
+	double local = 0.0;
+	{
+		cPetscDistVectorReadView a0(v0), a(v), e(ev);
+		for (size_t i = 0; i < a.size(); i++){
+			const double r = (a[i] - a0[i]) / e[i];
+			local += r * r;
+		}
+	}
+	double global;
+	PetscErrorCode ierr = MPI_Allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, v.mpicomm()); CHKERR(ierr);
+	return global;
+}
+
+//data_misfit() divided by the number of data
+inline double data_misfit_normalized(const cPetscDistVector& v0, const cPetscDistVector& v, const cPetscDistVector& ev)
+{
+	return data_misfit(v0, v, ev) / (double)v.globalsize();
+}
+
+//Krylov solver and preconditioner settings, typically read from a control file block such as
+//	Solver Begin
+//		Type = GMRES
+//		Preconditioner = BJACOBI
+//		RelativeTolerance = 1e-8
+//		MaxIterations = 500
+//		Restart = 50
+//		ReusePreconditioner = yes
+//	Solver End
+//Type and Preconditioner are PETSc KSP and PC type names (CG, GMRES, FGMRES, BCGS, MINRES, LSQR, PREONLY
+//and NONE, JACOBI, BJACOBI, ICC, ILU, SOR, ASM, GAMG, SHELL). MaxIterations = 0 means the number of unknowns.
+//If OptionsPrefix is set, -<prefix>ksp_* and -<prefix>pc_* command line options override the block.
+class cPetscSolverPolicy{
+
+	static std::string lowercase(std::string s){
+		for (size_t i = 0; i < s.size(); i++) s[i] = (char)std::tolower((unsigned char)s[i]);
+		return s;
+	}
 
 public:
+	std::string ksptype = KSPCG;
+	std::string pctype = PCJACOBI;
+	double rtol = 1e-6;
+	double atol = 1e-12;
+	double dtol = 1e2;
+	PetscInt maxits = 0;
+	PetscInt restart = 30;//GMRES and FGMRES
+	PetscInt factorlevels = 0;//ICC and ILU fill
+	bool reusepreconditioner = false;//keep the preconditioner when the operator's values change
+	bool nonzeroguess = true;
+	std::string optionsprefix;
+
+	cPetscSolverPolicy(){ };
+
+	cPetscSolverPolicy(const std::string& _ksptype, const std::string& _pctype){
+		ksptype = lowercase(_ksptype);
+		pctype = lowercase(_pctype);
+	}
+
+	cPetscSolverPolicy(const cBlock& b){
+		std::string str;
+		if (b.getvalue("Type", str)) ksptype = lowercase(str);
+		if (b.getvalue("Preconditioner", str)) pctype = lowercase(str);
+		b.getvalue("RelativeTolerance", rtol);
+		b.getvalue("AbsoluteTolerance", atol);
+		b.getvalue("DivergenceTolerance", dtol);
+		int i;
+		if (b.getvalue("MaxIterations", i)) maxits = (PetscInt)i;
+		if (b.getvalue("Restart", i)) restart = (PetscInt)i;
+		if (b.getvalue("FactorLevels", i)) factorlevels = (PetscInt)i;
+		b.getvalue("ReusePreconditioner", reusepreconditioner);
+		b.getvalue("NonZeroInitialGuess", nonzeroguess);
+		b.getvalue("OptionsPrefix", optionsprefix);
+	}
+
+	//Configure a KSP for a system with nunknowns unknowns. If given, pcsetup replaces the PC type
+	//(e.g. with a PCSHELL) before the command line options are applied.
+	void apply(KSP ksp, const PetscInt nunknowns, const std::function<void(PC)>& pcsetup = nullptr) const
+	{
+		PetscErrorCode ierr;
+		PC pc;
+		ierr = KSPSetType(ksp, ksptype.c_str()); CHKERR(ierr);
+		ierr = KSPGetPC(ksp, &pc); CHKERR(ierr);
+		ierr = PCSetType(pc, pctype.c_str()); CHKERR(ierr);
+		if (pcsetup) pcsetup(pc);
+		if (ksptype == KSPGMRES || ksptype == KSPFGMRES){
+			ierr = KSPGMRESSetRestart(ksp, restart); CHKERR(ierr);
+		}
+		if (pctype == PCICC || pctype == PCILU){
+			ierr = PCFactorSetLevels(pc, factorlevels); CHKERR(ierr);
+		}
+		ierr = KSPSetTolerances(ksp, rtol, atol, dtol, maxits > 0 ? maxits : nunknowns); CHKERR(ierr);
+		ierr = KSPSetInitialGuessNonzero(ksp, nonzeroguess ? PETSC_TRUE : PETSC_FALSE); CHKERR(ierr);
+#if !PETSC_VERSION_LT(3,5,0)
+		//Before 3.5 reuse is the SAME_PRECONDITIONER flag given to KSPSetOperators, see cPetscSolver::setoperators
+		ierr = KSPSetReusePreconditioner(ksp, reusepreconditioner ? PETSC_TRUE : PETSC_FALSE); CHKERR(ierr);
+#endif
+		if (optionsprefix.size() > 0){
+			ierr = KSPSetOptionsPrefix(ksp, optionsprefix.c_str()); CHKERR(ierr);
+			ierr = KSPSetFromOptions(ksp); CHKERR(ierr);
+		}
+	}
 
-	cPetscDistVectorLocalView(cPetscDistVector& v){
-		pv = &v;
-		data = pv->getlocalarray();
+	std::string summary() const
+	{
+		return strprint("%s/%s rtol=%.1le atol=%.1le dtol=%.1le maxits=%d reusepc=%s", ksptype.c_str(), pctype.c_str(), rtol, atol, dtol, (int)maxits, reusepreconditioner ? "yes" : "no");
 	}
+};
 
-	~cPetscDistVectorLocalView(){
-		pv->restorelocalarray(data);
+//Convergence of one solve
+class cPetscSolveStats{
+
+public:
+	bool converged = false;
+	KSPConvergedReason reason = (KSPConvergedReason)0;
+	std::string reasonstring;
+	PetscInt iterations = 0;
+	double rnorm = 0.0;//final residual norm as reported by the KSP
+	double time = 0.0;//seconds in KSPSolve
+	bool pcrebuilt = false;//whether the preconditioner was (re)built for this solve
+
+	std::string summary() const
+	{
+		return strprint("%s %d its rnorm=%.3le time=%.3lfs%s", reasonstring.c_str(), (int)iterations, rnorm, time, pcrebuilt ? " (new PC)" : "");
 	}
+};
+
+//A KSP context that lives across repeated solves, so the preconditioner is built once and reused for every
+//right hand side while the operator is unchanged, and also after the operator changes if the policy says so.
+class cPetscSolver : public cPetscObject {
+
+	KSP ksp = PETSC_NULL;
+	cPetscSolverPolicy policy;
+	PetscInt nunknowns = 0;
+	bool pcstale = true;
+	std::function<void(PC)> pcsetup;
 
-	double& operator[](const size_t& i){
-		return data[i];
+	const PetscObject* pobj() const{
+		if (ksp) return (PetscObject*)&ksp;
+		else return (PetscObject*)PETSC_NULL;
 	}
 
+public:
+	std::vector<cPetscSolveStats> history;
+
+	cPetscSolver(const MPI_Comm comm, const cPetscSolverPolicy& _policy){
+		PetscErrorCode ierr = KSPCreate(comm, &ksp); CHKERR(ierr);
+		policy = _policy;
+	}
+
+	~cPetscSolver(){
+		if (ksp){
+			PetscErrorCode ierr = KSPDestroy(&ksp); CHKERR(ierr);
+		}
+	}
+
+	cPetscSolver(const cPetscSolver&) = delete;
+	cPetscSolver& operator=(const cPetscSolver&) = delete;
+
+	KSP getksp() const { return ksp; }
+
+	PC getpc() const {
+		PC pc;
+		PetscErrorCode ierr = KSPGetPC(ksp, &pc); CHKERR(ierr);
+		return pc;
+	}
+
+	const cPetscSolverPolicy& getpolicy() const { return policy; }
+
+	//Custom PC setup run by every setoperators() after the policy's PC type is set
+	void setpcsetup(const std::function<void(PC)>& f){
+		pcsetup = f;
+	}
+
+	//Operator A and the matrix P the preconditioner is built from (often A). Call again after A's values change.
+	void setoperators(const Mat& A, const Mat& P){
+		PetscErrorCode ierr;
+		if (policy.reusepreconditioner == false || history.size() == 0) pcstale = true;
+#if PETSC_VERSION_LT(3,5,0)
+		ierr = KSPSetOperators(ksp, A, P, pcstale ? SAME_NONZERO_PATTERN : SAME_PRECONDITIONER); CHKERR(ierr);
+#else
+		ierr = KSPSetOperators(ksp, A, P); CHKERR(ierr);
+#endif
+		PetscInt M, N;
+		ierr = MatGetSize(A, &M, &N); CHKERR(ierr);
+		nunknowns = N;
+		policy.apply(ksp, nunknowns, pcsetup);
+	}
+
+	void setoperators(const Mat& A){
+		setoperators(A, A);
+	}
+
+	//Force the preconditioner to be rebuilt on the next solve even if reuse is on (before PETSc 3.5, on the next setoperators())
+	void rebuildpreconditioner(){
+		pcstale = true;
+	}
+
+	//Solve A x = b, x is the initial guess if the policy has nonzeroguess
+	const cPetscSolveStats& solve(const cPetscDistVector& b, cPetscDistVector& x)
+	{
+		PetscErrorCode ierr;
+		cPetscSolveStats st;
+		st.pcrebuilt = pcstale;
+#if PETSC_VERSION_LT(3,5,0)
+		//The MatStructure flag given to KSPSetOperators already decided whether the PC is rebuilt
+#else
+		if (pcstale && policy.reusepreconditioner){
+			//Let this one solve rebuild it, then hold it again
+			ierr = KSPSetReusePreconditioner(ksp, PETSC_FALSE); CHKERR(ierr);
+		}
+#endif
+
+		double t1 = gettime();
+		ierr = KSPSolve(ksp, b.vec(), x.vec()); CHKERR(ierr);
+		double t2 = gettime();
+
+#if !PETSC_VERSION_LT(3,5,0)
+		if (pcstale && policy.reusepreconditioner){
+			ierr = KSPSetReusePreconditioner(ksp, PETSC_TRUE); CHKERR(ierr);
+		}
+#endif
+		pcstale = false;
+
+		ierr = KSPGetIterationNumber(ksp, &st.iterations); CHKERR(ierr);
+		ierr = KSPGetResidualNorm(ksp, &st.rnorm); CHKERR(ierr);
+		ierr = KSPGetConvergedReason(ksp, &st.reason); CHKERR(ierr);
+		st.converged = st.reason > 0;
+		st.reasonstring = std::string(KSPConvergedReasons[st.reason]);
+		st.time = t2 - t1;
+		history.push_back(st);
+		return history.back();
+	}
+
+	cPetscDistVector solve(const cPetscDistVector& b)
+	{
+		Mat A, P;
+		PetscErrorCode ierr = KSPGetOperators(ksp, &A, &P); CHKERR(ierr);
+		PetscInt m, n;
+		ierr = MatGetLocalSize(A, &m, &n); CHKERR(ierr);
+		cPetscDistVector x("x", mpicomm(), n, nunknowns, 0.0);
+		solve(b, x);
+		return x;
+	}
+
+	const cPetscSolveStats& laststats() const {
+		return history.back();
+	}
+
+	PetscInt totaliterations() const {
+		PetscInt n = 0;
+		for (size_t i = 0; i < history.size(); i++) n += history[i].iterations;
+		return n;
+	}
 };
 
 class cPetscDistMatrix : public cPetscObject {
@@ -976,6 +1431,178 @@ ierr = MatGetLocalSize(mat(), &m, &n); CHKERR(ierr);
 		return true;
 	}
 
+	//Fast assembly path: each rank supplies only its own rows in CSR form (rowptr has nlocalrows+1 entries,
+	//colind holds global column indices, unique within a row). The diagonal/off-diagonal block counts are
+	//exact so there are no mallocs during insertion, rows are inserted with one MatSetValues each, and since
+	//nothing is off-process the assembly needs no communication.
+	bool create_fromlocalcsr(const std::string& name, const MPI_Comm comm, const std::vector<PetscInt>& rowptr, const std::vector<PetscInt>& colind, const std::vector<double>& values, const PetscInt _nlocalcols, const PetscInt _nglobalcols)
+	{
+		PetscErrorCode ierr;
+		const PetscInt nlr = (PetscInt)rowptr.size() - 1;
+		if (nlr < 0 || (PetscInt)colind.size() != rowptr[nlr] || values.size() != colind.size()){
+			printf("cPetscDistMatrix::create_fromlocalcsr(...) rowptr, colind and values are inconsistent\n");
+			throw(strprint("Error: exception throw from %s (%d) %s\n", __FILE__, __LINE__, __FUNCTION__));
+		}
+
+		cMpiComm mc(comm);
+		PetscInt nlc = _nlocalcols;
+		PetscInt ngc = _nglobalcols;
+		if (nlc == PETSC_DECIDE){
+			nlc = cOwnership(mc.size(), mc.rank(), ngc).nlocal();
+		}
+		else if (ngc == PETSC_DETERMINE){
+			ngc = mc.allreduce(nlc);
+		}
+		PetscInt cstart = 0;
+		ierr = MPI_Exscan(&nlc, &cstart, 1, MPIU_INT, MPI_SUM, comm); CHKERR(ierr);
+		if (mc.rank() == 0) cstart = 0;
+		const cOwnership cown(cstart, cstart + nlc);
+
+		std::vector<PetscInt> d_nnz(nlr, 0);
+		std::vector<PetscInt> o_nnz(nlr, 0);
+		for (PetscInt i = 0; i < nlr; i++){
+			for (PetscInt k = rowptr[i]; k < rowptr[i + 1]; k++){
+				if (cown.owns(colind[k])) d_nnz[i]++;
+				else o_nnz[i]++;
+			}
+		}
+
+		deallocate();
+		pMat = new Mat;
+		ierr = MatCreateAIJ(comm, nlr, nlc, PETSC_DETERMINE, ngc, 0, d_nnz.data(), 0, o_nnz.data(), ncmatptr()); CHKERR(ierr);
+		ierr = MatSetOption(mat(), MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_TRUE); CHKERR(ierr);
+		ierr = MatSetOption(mat(), MAT_NO_OFF_PROC_ENTRIES, PETSC_TRUE); CHKERR(ierr);
+		setname(name);
+
+		const PetscInt rstart = rowownership().start;
+		for (PetscInt i = 0; i < nlr; i++){
+			const PetscInt gr = rstart + i;
+			const PetscInt nc = rowptr[i + 1] - rowptr[i];
+			if (nc == 0) continue;
+			ierr = MatSetValues(mat(), 1, &gr, nc, &colind[rowptr[i]], &values[rowptr[i]], INSERT_VALUES); CHKERR(ierr);
+		}
+		assemble();
+		return true;
+	}
+
+	//Convert triplets of locally owned rows (global row indices starting at rowstart) to CSR, columns sorted and duplicates summed
+	static void triplets_to_csr(const PetscInt nlocalrows, const PetscInt rowstart, const std::vector<PetscInt>& rowind, const std::vector<PetscInt>& colind, const std::vector<double>& values, std::vector<PetscInt>& rowptr, std::vector<PetscInt>& csrcol, std::vector<double>& csrval)
+	{
+		const size_t nnz = rowind.size();
+		rowptr.assign((size_t)nlocalrows + 1, 0);
+		for (size_t k = 0; k < nnz; k++) rowptr[(size_t)(rowind[k] - rowstart) + 1]++;
+		for (PetscInt i = 0; i < nlocalrows; i++) rowptr[i + 1] += rowptr[i];
+
+		std::vector<PetscInt> next(rowptr.begin(), rowptr.end() - 1);
+		std::vector<std::pair<PetscInt, double>> e(nnz);
+		for (size_t k = 0; k < nnz; k++){
+			e[(size_t)next[rowind[k] - rowstart]++] = std::make_pair(colind[k], values[k]);
+		}
+
+		csrcol.clear();
+		csrval.clear();
+		csrcol.reserve(nnz);
+		csrval.reserve(nnz);
+		PetscInt out = 0;
+		for (PetscInt i = 0; i < nlocalrows; i++){
+			const PetscInt begin = rowptr[i];
+			const PetscInt end = rowptr[i + 1];
+			std::sort(e.begin() + begin, e.begin() + end, [](const std::pair<PetscInt, double>& a, const std::pair<PetscInt, double>& b){ return a.first < b.first; });
+			rowptr[i] = out;
+			for (PetscInt k = begin; k < end; k++){
+				if (k > begin && e[k].first == csrcol.back()) csrval.back() += e[k].second;
+				else{
+					csrcol.push_back(e[k].first);
+					csrval.push_back(e[k].second);
+					out++;
+				}
+			}
+		}
+		rowptr[nlocalrows] = out;
+	}
+
+	//Like create_fromglobalindices but each rank passes only the triplets it generated, for any rows.
+	//They are sent to the owning ranks with one alltoallv per array, so no rank scans the full set,
+	//then duplicates are summed and assembled with create_fromlocalcsr.
+	//The column layout must be given by _nglobalcols and/or _nlocalcols, it is not inferred from colind.
+	//Bad input on any rank makes all ranks throw, before any triplets are exchanged.
+	bool create_fromtriplets_redistribute(const std::string& name, const MPI_Comm comm, const std::vector<PetscInt>& rowind, const std::vector<PetscInt>& colind, const std::vector<double>& values, const PetscInt _nlocalrows, const PetscInt _nlocalcols, const PetscInt _nglobalrows, const PetscInt _nglobalcols)
+	{
+		cMpiComm mc(comm);
+		const int size = mc.size();
+		const size_t nnz = rowind.size();
+
+		//Local checks, agreed on by all ranks before throwing
+		enum { OK = 0, BADSIZES = 1, NOCOLUMNS = 2, BADROW = 4, BADCOL = 8 };
+		int bad = OK;
+		if (colind.size() != nnz || values.size() != nnz) bad |= BADSIZES;
+		if (_nglobalcols == PETSC_DECIDE && _nlocalcols == PETSC_DECIDE) bad |= NOCOLUMNS;
+
+		//Row ownership of every rank
+		std::vector<PetscInt> rowend(size);
+		if (_nlocalrows == PETSC_DECIDE){
+			for (int p = 0; p < size; p++) rowend[p] = cOwnership(size, p, _nglobalrows).end;
+		}
+		else{
+			std::vector<PetscInt> n;
+			mc.allgatherv(std::vector<PetscInt>(1, _nlocalrows), n);
+			PetscInt e = 0;
+			for (int p = 0; p < size; p++) rowend[p] = (e += n[p]);
+		}
+
+		//Bucket by owner
+		std::vector<int> owner(nnz);
+		std::vector<int> sendcounts(size, 0);
+		for (size_t k = 0; (bad & BADSIZES) == 0 && k < nnz; k++){
+			owner[k] = (int)(std::upper_bound(rowend.begin(), rowend.end(), rowind[k]) - rowend.begin());
+			if (rowind[k] < 0 || owner[k] >= size){
+				bad |= BADROW;
+				break;
+			}
+			if (colind[k] < 0 || (_nglobalcols != PETSC_DECIDE && colind[k] >= _nglobalcols)){
+				bad |= BADCOL;
+				break;
+			}
+			sendcounts[owner[k]]++;
+		}
+
+		bad = mc.allreduce(bad, MPI_BOR);
+		if (bad != OK){
+			if (mc.rank() == 0){
+				if (bad & BADSIZES) printf("cPetscDistMatrix::create_fromtriplets_redistribute(...) rowind, colind, and vals must be the same size\n");
+				if (bad & NOCOLUMNS) printf("cPetscDistMatrix::create_fromtriplets_redistribute(...) _nglobalcols or _nlocalcols must be given\n");
+				if (bad & BADROW) printf("cPetscDistMatrix::create_fromtriplets_redistribute(...) row index out of range\n");
+				if (bad & BADCOL) printf("cPetscDistMatrix::create_fromtriplets_redistribute(...) column index out of range\n");
+			}
+			throw(strprint("Error: exception throw from %s (%d) %s\n", __FILE__, __LINE__, __FUNCTION__));
+		}
+		std::vector<int> pos = cMpiComm::displacements(sendcounts);
+		std::vector<PetscInt> srow(nnz), scol(nnz);
+		std::vector<double> sval(nnz);
+		for (size_t k = 0; k < nnz; k++){
+			const int q = pos[owner[k]]++;
+			srow[q] = rowind[k];
+			scol[q] = colind[k];
+			sval[q] = values[k];
+		}
+
+		std::vector<PetscInt> rrow, rcol;
+		std::vector<double> rval;
+		std::vector<int> recvcounts;
+		mc.alltoallv(srow, sendcounts, rrow, recvcounts);
+		mc.alltoallv(scol, sendcounts, rcol, recvcounts);
+		mc.alltoallv(sval, sendcounts, rval, recvcounts);
+
+		const int rank = mc.rank();
+		const PetscInt rstart = rank == 0 ? 0 : rowend[rank - 1];
+		const PetscInt nlr = rowend[rank] - rstart;
+		std::vector<PetscInt> rowptr, csrcol;
+		std::vector<double> csrval;
+		triplets_to_csr(nlr, rstart, rrow, rcol, rval, rowptr, csrcol, csrval);
+
+		return create_fromlocalcsr(name, comm, rowptr, csrcol, csrval, _nlocalcols, _nglobalcols);
+	}
+
 	bool preallocate(const PetscInt d_nz, const PetscInt o_nz) const
 	{
 		PetscErrorCode ierr = MatMPIAIJSetPreallocation(mat(), d_nz, PETSC_NULL, o_nz, PETSC_NULL); CHKERR(ierr);
@@ -1346,75 +1973,52 @@ return b;
 		return v.dot(vecmult(v));
 	}
 
-	cPetscDistVector solve_CG(const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector())
+	//A x = b with the given policy. For repeated solves with the same matrix keep a cPetscSolver instead.
+	cPetscDistVector solve(const cPetscSolverPolicy& policy, const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector(), cPetscSolveStats* stats = PETSC_NULL)
 	{
-		//A x = b
 		cPetscDistVector x;//solution vector that will be returned
-		if (initialguess.globalsize() == 0){
-			x.create("x",mpicomm(), nlocalcols(), nglobalcols(), 0.0);
+		if (initialguess.allocated() == false){
+			x.create("x", mpicomm(), nlocalcols(), nglobalcols(), 0.0);
 		}
 		else{
 			x = initialguess;
 		}
+		cPetscSolver S(mpicomm(), policy);
+		S.setoperators(mat());
+		const cPetscSolveStats& st = S.solve(b, x);
+		if (stats) *stats = st;
+		return x;
+	}
 
-		cPetscDistVector ir = vecmult(x) - b;
+	cPetscDistVector solve_CG(const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector())
+	{
+		//A x = b
+		cPetscSolverPolicy policy(KSPCG, PCJACOBI);
+		policy.rtol = 1e-6;
+		policy.atol = 1e-12;
+		policy.dtol = 1e2;
+
+		cPetscDistVector x0;
+		if (initialguess.allocated() == false){
+			x0.create("x", mpicomm(), nlocalcols(), nglobalcols(), 0.0);
+		}
+		else{
+			x0 = initialguess;
+		}
+		cPetscDistVector ir = vecmult(x0) - b;
 		double inorm = ir.norm2();
 
-		KSP ksp;
-		PC  pc;
-		PetscErrorCode ierr;
-		ierr = KSPCreate(mpicomm(), &ksp); CHKERR(ierr);
-#if PETSC_VERSION_LT(3,5,0)
-		ierr = KSPSetOperators(ksp, mat(), mat(), SAME_NONZERO_PATTERN); CHKERR(ierr);		
-#else
-		ierr = KSPSetOperators(ksp, mat(), mat()); CHKERR(ierr);
-#endif
-		ierr = KSPSetInitialGuessNonzero(ksp, PETSC_TRUE); CHKERR(ierr);
-		ierr = KSPGetPC(ksp, &pc); CHKERR(ierr);
-		ierr = KSPSetType(ksp, KSPCG); CHKERR(ierr);
-		ierr = PCSetType(pc, PCJACOBI); CHKERR(ierr);
-
-		//rtol    - the relative convergence tolerance (relative decrease in the residual norm)  
-		//abstol  - the absolute convergence tolerance (absolute size of the residual norm)  
-		//dtol    - the divergence tolerance (amount residual can increase before KSPDefaultConverged() concludes that the method is diverging)  
-		//maxits  - maximum number of iterations to use  
-
-		double reltol = 1e-6;
-		double abstol = 1e-12;
-		double divtol = 1e2;
-		PetscInt maxits = nglobalcols();
-		//PetscInt maxits = 400;
-
-
-		ierr = KSPSetTolerances(ksp, reltol, abstol, divtol, maxits); CHKERR(ierr);
-
-		//Point to function that monitors/outputs convergence progress at each CG iteration
-		//ierr = KSPMonitorSet(ksp, kspmonitor, this, PETSC_NULL); CHKERR(ierr);
-		//See also PETSC functions KSPMonitorDefault, KSPMonitorTrueResidualNorm, KSPMonitorTrueResidualMaxNorm
-		//ierr = KSPMonitorSet(ksp, KSPMonitorDefault, PETSC_NULL, PETSC_NULL); CHKERR(ierr);
-
-		//Setup and run the Conjugate Gradients algorithm
-		ierr = KSPSetUp(ksp); CHKERR(ierr);
-		ierr = KSPSolve(ksp, b.vec(), x.vec()); CHKERR(ierr);
+		cPetscSolveStats st;
+		cPetscDistVector x = solve(policy, b, x0, &st);
 
 		cPetscDistVector r = vecmult(x) - b;
 		double anorm = r.norm2();
 
-		//Output reason for convergence/divergence
-		PetscInt niterations;
-		double residnorm;
-		ierr = KSPGetIterationNumber(ksp, &niterations); CHKERR(ierr);
-		ierr = KSPGetResidualNorm(ksp, &residnorm); CHKERR(ierr);
-		KSPConvergedReason reason;
-		ierr = KSPGetConvergedReason(ksp, &reason); CHKERR(ierr);
-		std::string reasonstring = std::string(KSPConvergedReasons[reason]);
-		ierr = KSPDestroy(&ksp);
-
 		if (mpirank() == 0){
 			std::string s;
-			s += strprint("CG %s ", reasonstring.c_str());
-			s += strprint("%d Its ", niterations);
-			s += strprint("rnorm = %3.1le ", residnorm);
+			s += strprint("CG %s ", st.reasonstring.c_str());
+			s += strprint("%d Its ", st.iterations);
+			s += strprint("rnorm = %3.1le ", st.rnorm);
 			s += strprint("inorm = %3.1le ", inorm);
 			s += strprint("anorm = %3.1le ", anorm);
 			s += strprint("reduc = %3.1le ", anorm / inorm);
@@ -1495,20 +2099,78 @@ return b;
 
 class cPetscDistShellMatrix : public cPetscObject {
 
+public:
+	//y = A x or y = A' x, or z = M^-1 r for a preconditioner
+	typedef std::function<void(const cPetscDistVector& x, cPetscDistVector& y)> cOperator;
+
 private:
 
 	//Private data members		
 	Mat* pMat = PETSC_NULL;
+	cOperator multop;
+	cOperator multtransposeop;
+	cOperator preconditionerop;
 
 	const PetscObject* pobj() const{
 		if (pMat) return (PetscObject*) pMat;
 		else return (PetscObject*) PETSC_NULL;
 	}
 
+	//Callbacks from PETSc to the typed operators, the shell context is this object.
+	//Exceptions must not propagate through PETSc's C stack so they become an error code.
+	static PetscErrorCode shellmult(Mat A, Vec x, Vec y)
+	{
+		void* context;
+		PetscErrorCode ierr = MatShellGetContext(A, &context); CHKERR(ierr);
+		cPetscDistShellMatrix* pA = (cPetscDistShellMatrix*)context;
+		try{
+			const cPetscDistVector vx(x);
+			cPetscDistVector vy(y);
+			pA->multop(vx, vy);
+		}
+		catch (...){
+			return PETSC_ERR_USER;
+		}
+		return 0;
+	}
+
+	static PetscErrorCode shellmulttranspose(Mat A, Vec x, Vec y)
+	{
+		void* context;
+		PetscErrorCode ierr = MatShellGetContext(A, &context); CHKERR(ierr);
+		cPetscDistShellMatrix* pA = (cPetscDistShellMatrix*)context;
+		try{
+			const cPetscDistVector vx(x);
+			cPetscDistVector vy(y);
+			pA->multtransposeop(vx, vy);
+		}
+		catch (...){
+			return PETSC_ERR_USER;
+		}
+		return 0;
+	}
+
+	static PetscErrorCode shellpcapply(PC pc, Vec r, Vec z)
+	{
+		void* context;
+		PetscErrorCode ierr = PCShellGetContext(pc, &context); CHKERR(ierr);
+		cPetscDistShellMatrix* pA = (cPetscDistShellMatrix*)context;
+		try{
+			const cPetscDistVector vr(r);
+			cPetscDistVector vz(z);
+			pA->preconditionerop(vr, vz);
+		}
+		catch (...){
+			return PETSC_ERR_USER;
+		}
+		return 0;
+	}
+
 public:		
 	bool _converged;
 	KSPConvergedReason _conv_reason_code;
 	std::string _conv_reason_str;
+	std::string _ksp_type = "CG";
 	PetscInt _niterations;	
 	double _rnorm_start;
 	double _rnorm_end;	
@@ -1519,6 +2181,14 @@ public:
 		create(name, comm, nlocalrows, nlocalcols, nglobalrows, nglobalcols, context);
 	}
 
+	//For use with set_multiply() etc, the shell context is this object so it must not be copied or moved
+	cPetscDistShellMatrix(const std::string& name, const MPI_Comm& comm, const PetscInt& nlocalrows, const PetscInt& nlocalcols, const PetscInt& nglobalrows, const PetscInt& nglobalcols){
+		create(name, comm, nlocalrows, nlocalcols, nglobalrows, nglobalcols, this);
+	}
+
+	cPetscDistShellMatrix(const cPetscDistShellMatrix&) = delete;
+	cPetscDistShellMatrix& operator=(const cPetscDistShellMatrix&) = delete;
+
 	~cPetscDistShellMatrix()
 	{
 		PetscErrorCode ierr = MatDestroy(ncmatptr()); CHKERR(ierr);
@@ -1547,6 +2217,33 @@ public:
 		return true;
 	}
 
+	//y = A x, e.g. a Jacobian-vector product from the forward model. Replaces any user context with this object.
+	bool set_multiply(const cOperator& op){
+		multop = op;
+		PetscErrorCode ierr;
+		ierr = MatShellSetContext(mat(), this); CHKERR(ierr);
+		ierr = MatShellSetOperation(mat(), MATOP_MULT, (void(*)(void))shellmult); CHKERR(ierr);
+		return true;
+	}
+
+	//y = A' x, needed by LSQR
+	bool set_multiply_transpose(const cOperator& op){
+		multtransposeop = op;
+		PetscErrorCode ierr;
+		ierr = MatShellSetContext(mat(), this); CHKERR(ierr);
+		ierr = MatShellSetOperation(mat(), MATOP_MULT_TRANSPOSE, (void(*)(void))shellmulttranspose); CHKERR(ierr);
+		return true;
+	}
+
+	//z = M^-1 r, applied through a PCSHELL by the solve functions
+	bool set_preconditioner(const cOperator& op){
+		preconditionerop = op;
+		return true;
+	}
+
+	bool has_preconditioner() const {
+		return preconditionerop ? true : false;
+	}
 	
 	PetscInt nglobalrows() const
 	{
@@ -1582,7 +2279,7 @@ public:
 
 	cPetscDistVector vecmult(const cPetscDistVector& x) const
 	{		
-		cPetscDistVector b(mpicomm(), nlocalcols(), nglobalcols());
+		cPetscDistVector b(mpicomm(), nlocalrows(), nglobalrows());
 		vecmult(x, b);
 		return b;
 	}
@@ -1592,6 +2289,18 @@ public:
 	PetscErrorCode ierr = MatMult(mat(), x.vec(), b.vec()); CHKERR(ierr);
 	}
 
+	cPetscDistVector transvecmult(const cPetscDistVector& x) const
+	{
+		cPetscDistVector b(mpicomm(), nlocalcols(), nglobalcols());
+		transvecmult(x, b);
+		return b;
+	}
+
+	void transvecmult(const cPetscDistVector& x, cPetscDistVector& b) const
+	{
+		PetscErrorCode ierr = MatMultTranspose(mat(), x.vec(), b.vec()); CHKERR(ierr);
+	}
+
 	static PetscErrorCode kspmonitor(KSP ksp, PetscInt n, double rnorm, void *context)
 	{				
 		int k;
@@ -1610,94 +2319,103 @@ public:
 		return 0;
 	}
 
-	cPetscDistVector solve_CG(const cPetscDistMatrix& P, const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector())
-	{		
-		//A x = b
-		cPetscDistVector x;//solution vector that will be returned
-		if (initialguess.globalsize() == 0){			
-			x.create("x",mpicomm(), nlocalcols(), nglobalcols(), 0.0);
-		}
-		else{	
-			x = initialguess;
-		}
+	//Policy for the convenience solvers below, keeping the tolerances they have always used
+	static cPetscSolverPolicy shellpolicy(const std::string& ksptype, const std::string& pctype)
+	{
+		cPetscSolverPolicy policy(ksptype, pctype);
+		policy.rtol = 1e-10;
+		policy.atol = 1e-50;
+		policy.dtol = 1e4;
+		policy.maxits = 0;//number of unknowns
+		return policy;
+	}
 
-		KSP ksp;
-		PC  pc;
-		PetscErrorCode ierr;
-		ierr = KSPCreate(mpicomm(), &ksp); CHKERR(ierr);
-#if PETSC_VERSION_LT(3,5,0)
-		ierr = KSPSetOperators(ksp, mat(), P.mat(), SAME_NONZERO_PATTERN); CHKERR(ierr);
-#else
-		ierr = KSPSetOperators(ksp, mat(), P.mat()); CHKERR(ierr);
-#endif
+	//Solve with any KSP type. The preconditioner is the set_preconditioner() shell if there is one,
+	//otherwise Jacobi on P if P is given, otherwise none.
+	cPetscDistVector solve(const KSPType ksptype, const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector(), const cPetscDistMatrix* P = PETSC_NULL, const PetscInt restart = 30)
+	{
+		cPetscSolverPolicy policy = shellpolicy(ksptype, P ? PCJACOBI : PCNONE);
+		policy.restart = restart;
+		return solve(policy, b, initialguess, P);
+	}
 
-		ierr = KSPSetInitialGuessNonzero(ksp, PETSC_TRUE); CHKERR(ierr);
-		ierr = KSPGetPC(ksp, &pc); CHKERR(ierr);
-		ierr = KSPSetType(ksp, KSPCG); CHKERR(ierr);
-		ierr = PCSetType(pc, PCJACOBI); CHKERR(ierr);
-
-		//rtol    - the relative convergence tolerance (relative decrease in the residual norm)  
-		//abstol  - the absolute convergence tolerance (absolute size of the residual norm)  
-		//dtol    - the divergence tolerance (amount residual can increase before KSPDefaultConverged() concludes that the method is diverging)  
-		//maxits  - maximum number of iterations to use  
-
-		double reltol, abstol, divtol;
-		PetscInt maxits;
-		ierr = KSPGetTolerances(ksp, &reltol, &abstol, &divtol, &maxits); CHKERR(ierr);
-		reltol = 1e-10;
-		abstol = 1e-50;
-		divtol = 1e4;
-		maxits = nglobalcols();
-		ierr = KSPSetTolerances(ksp, reltol, abstol, divtol, maxits); CHKERR(ierr);
-		//ierr = KSPSetTolerances(ksp, PETSC_DEFAULT,PETSC_DEFAULT,PETSC_DEFAULT, maxits); CHKERR(ierr);
-
-		//Point to function that monitors/outputs convergence progress at each CG iteration
-		ierr = KSPMonitorSet(ksp, kspmonitor, this, PETSC_NULL); CHKERR(ierr);
-		//See also PETSC functions KSPMonitorDefault, KSPMonitorTrueResidualNorm, KSPMonitorTrueResidualMaxNorm
-		//ierr = KSPMonitorSet(ksp, KSPMonitorDefault, PETSC_NULL, PETSC_NULL); CHKERR(ierr);
-				
-		//Setup and run the Conjugate Gradients algorithm
-		ierr = KSPSetUp(ksp); CHKERR(ierr);
+	//Use this operator in a cPetscSolver, P (if given) is what a non-shell preconditioner is built from.
+	//If set_preconditioner() was called the policy's PC type is replaced by the PCSHELL, also on later
+	//S.setoperators() calls, unless -<prefix>pc_type overrides it.
+	void configure(cPetscSolver& S, const cPetscDistMatrix* P = PETSC_NULL)
+	{
+		if (has_preconditioner()){
+			S.setpcsetup([this](PC pc){
+				PetscErrorCode ierr;
+				ierr = PCSetType(pc, PCSHELL); CHKERR(ierr);
+				ierr = PCShellSetContext(pc, this); CHKERR(ierr);
+				ierr = PCShellSetApply(pc, shellpcapply); CHKERR(ierr);
+			});
+		}
+		else S.setpcsetup(nullptr);
+		S.setoperators(mat(), P ? P->mat() : mat());
+	}
 
-		double t1 = gettime();
-		ierr = KSPSolve(ksp, b.vec(), x.vec()); CHKERR(ierr);
-		double t2 = gettime();
-				
-		ierr = KSPGetIterationNumber(ksp, &_niterations); CHKERR(ierr);
-		ierr = KSPGetResidualNorm(ksp, &_rnorm_end); CHKERR(ierr);
-		ierr = KSPGetConvergedReason(ksp, &_conv_reason_code); CHKERR(ierr);
-		
-		_solve_time = t2 - t1;
-		_conv_reason_str = std::string(KSPConvergedReasons[_conv_reason_code]);
-		if (_conv_reason_code <= 0){
-			_converged = false;
+	cPetscDistVector solve(const cPetscSolverPolicy& policy, const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector(), const cPetscDistMatrix* P = PETSC_NULL)
+	{
+		cPetscDistVector x;
+		if (initialguess.allocated() == false){
+			x.create("x", mpicomm(), nlocalcols(), nglobalcols(), 0.0);
 		}
 		else{
-			_converged = true;
+			x = initialguess;
 		}
-
-		ierr = KSPDestroy(&ksp);		
+		cPetscSolver S(mpicomm(), policy);
+		configure(S, P);
+		PetscErrorCode ierr = KSPMonitorSet(S.getksp(), kspmonitor, this, PETSC_NULL); CHKERR(ierr);
+		const cPetscSolveStats& st = S.solve(b, x);
+		_niterations = st.iterations;
+		_rnorm_end = st.rnorm;
+		_conv_reason_code = st.reason;
+		_conv_reason_str = st.reasonstring;
+		_converged = st.converged;
+		_solve_time = st.time;
+		_ksp_type = policy.ksptype;
+		for (size_t i = 0; i < _ksp_type.size(); i++) _ksp_type[i] = (char)std::toupper((unsigned char)_ksp_type[i]);
 		return x;
 	}
+
+	//Least squares min|Ax-b|, A need not be square, needs set_multiply_transpose()
+	cPetscDistVector solve_LSQR(const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector())
+	{
+		return solve(KSPLSQR, b, initialguess);
+	}
+
+	//Square non-symmetric systems, e.g. Gauss-Newton steps with a non-symmetric regularisation
+	cPetscDistVector solve_GMRES(const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector(), const PetscInt restart = 30)
+	{
+		return solve(KSPGMRES, b, initialguess, PETSC_NULL, restart);
+	}
+
+	cPetscDistVector solve_CG(const cPetscDistMatrix& P, const cPetscDistVector& b, const cPetscDistVector& initialguess = cPetscDistVector())
+	{
+		//A x = b, preconditioned by the shell if there is one, otherwise Jacobi on P
+		return solve(shellpolicy(KSPCG, PCJACOBI), b, initialguess, &P);
+	}
 	
 	std::string convergence_summary(){		
 		std::string s;
-		if (_converged) s += strprint("CG Converged\n");
-		else  s += strprint("CG Diverged\n");		
-		s += strprint("\tCG Iterations=%d\n", _niterations);
+		if (_converged) s += strprint("%s Converged\n", _ksp_type.c_str());
+		else  s += strprint("%s Diverged\n", _ksp_type.c_str());		
+		s += strprint("\t%s Iterations=%d\n", _ksp_type.c_str(), _niterations);
 		s += strprint("\tReason = %d (%s)\n", _conv_reason_code, _conv_reason_str.c_str());
 		s += strprint("\tResidual norm at start = %8.6le\n", _rnorm_start);
 		s += strprint("\tResidual norm at end = %8.6le\n", _rnorm_end);
 		s += strprint("\tResidual norm reduction = %8.6le\n", _rnorm_end / _rnorm_start);
 		s += strprint("\tSolve time = %8.5lf\n", _solve_time);
-		s += strprint("\tTime per CG iteration = %8.5lf\n", _solve_time / (double)_niterations);
+		s += strprint("\tTime per %s iteration = %8.5lf\n", _ksp_type.c_str(), _solve_time / (double)_niterations);
 		return s;
 	}
 
 	//Operators
 	cPetscDistVector operator*(const cPetscDistVector& x) const 
 	{				
-	cPetscDistVector b(mpicomm(), nlocalcols(), nglobalcols());
+	cPetscDistVector b(mpicomm(), nlocalrows(), nglobalrows());
 	vecmult(x, b);
 	return b;
 	}
@@ -0,0 +1,461 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _profiler_H
+#define _profiler_H
+
+#include <cstring>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "logger.h"
+#include "general_utils.h"
+#include "memusage.h"
+#include "perfcounters.h"
+
+#if defined _MPI_ENABLED
+#include "mpi_wrapper.h"
+#endif
+
+//Should define USEPROFILER as a compiler preprocessor definition
+//so that it is defined across all source units
+//#define USEPROFILER
+
+#ifdef USEPROFILER
+	#define _PROFILEZONE_(name) cProfileZone _profilezone(name);
+#else
+	#define _PROFILEZONE_(name)
+#endif
+
+class cProfiler; //forward declaration only
+
+//extern only here - declare the actual global instance of the object in the main program .cpp file
+extern class cProfiler gprofiler;
+
+class cProfileStats{
+
+public:
+	size_t count = 0;
+	double total = 0.0;
+	double min = DBL_MAX;
+	double max = 0.0;
+	int64_t peakmemory = 0;//kB, largest VmHWM seen on exit
+	int64_t memorychange = 0;//kB, summed change in rss across calls
+	cPerfCounts counts;//hardware counters, inclusive of child zones
+
+	void add(const double& t){
+		count++;
+		total += t;
+		if (t < min) min = t;
+		if (t > max) max = t;
+	}
+
+	void merge(const cProfileStats& s){
+		count += s.count;
+		total += s.total;
+		if (s.min < min) min = s.min;
+		if (s.max > max) max = s.max;
+		if (s.peakmemory > peakmemory) peakmemory = s.peakmemory;
+		memorychange += s.memorychange;
+		counts += s.counts;
+	}
+
+	void addmemory(const int64_t& peak, const int64_t& change){
+		if (peak > peakmemory) peakmemory = peak;
+		memorychange += change;
+	}
+};
+
+class cProfileNode{
+
+public:
+	std::string name;
+	const char* key = nullptr;//the static name pointer, compared first to avoid string comparisons
+	size_t parent = 0;
+	std::vector<size_t> children;
+	cProfileStats stats;
+};
+
+class cProfileEvent{
+
+public:
+	const char* name;
+	int threadid;
+	double start;//microseconds since the profiler epoch
+	double duration;//microseconds
+};
+
+//The call tree of one thread, node 0 is the root
+class cProfileTree{
+
+public:
+	int threadid = 0;
+	bool registered = false;
+	std::vector<cProfileNode> nodes;
+	std::vector<cProfileEvent> events;
+	size_t current = 0;
+
+	cProfileTree(){
+		nodes.resize(1);
+		nodes[0].name = "root";
+	}
+
+	~cProfileTree();
+
+	size_t child(const size_t parent, const char* name, const bool isstatic = true){
+		//Pointer keys first, so the hot path of re-entering a static zone does no string comparisons
+		const std::vector<size_t>& c = nodes[parent].children;
+		if (isstatic){
+			for (size_t i = 0; i < c.size(); i++){
+				if (nodes[c[i]].key == name) return c[i];
+			}
+		}
+		//Non-static lookups, and a static name seen for the first time under this parent (which may match
+		//a node created by merge() or by the same name at another address)
+		for (size_t i = 0; i < c.size(); i++){
+			cProfileNode& cn = nodes[c[i]];
+			if (cn.name == name){
+				if (isstatic && cn.key == nullptr) cn.key = name;
+				return c[i];
+			}
+		}
+		cProfileNode n;
+		n.name = name;
+		if (isstatic) n.key = name;
+		n.parent = parent;
+		nodes.push_back(n);
+		nodes[parent].children.push_back(nodes.size() - 1);
+		return nodes.size() - 1;
+	}
+
+	size_t enter(const char* name){
+		current = child(current, name);
+		return current;
+	}
+
+	void exit(const size_t node, const double& t){
+		nodes[node].stats.add(t);
+		current = nodes[node].parent;
+	}
+
+	void merge(const cProfileTree& t, const size_t tnode = 0, const size_t node = 0){
+		if (tnode != 0) nodes[node].stats.merge(t.nodes[tnode].stats);
+		for (size_t i = 0; i < t.nodes[tnode].children.size(); i++){
+			const size_t tc = t.nodes[tnode].children[i];
+			const size_t c = child(node, t.nodes[tc].name.c_str(), false);
+			merge(t, tc, c);
+		}
+	}
+
+	std::string path(size_t node) const {
+		std::string p = nodes[node].name;
+		while (nodes[node].parent != 0){
+			node = nodes[node].parent;
+			p = nodes[node].name + "/" + p;
+		}
+		return p;
+	}
+
+	size_t findpath(const std::string& p){
+		size_t node = 0;
+		std::vector<std::string> names = split(p, '/');
+		for (size_t i = 0; i < names.size(); i++){
+			node = child(node, names[i].c_str(), false);
+		}
+		return node;
+	}
+
+	void clear(){
+		nodes.resize(1);
+		nodes[0].children.clear();
+		nodes[0].stats = cProfileStats();
+		events.clear();
+		current = 0;
+	}
+};
+
+//Registry of the per-thread call trees, merged on demand for reporting
+class cProfiler{
+
+private:
+	std::mutex mtx;
+	std::vector<cProfileTree*> live;
+	cProfileTree retired;
+	int nthreads = 0;
+
+public:
+	std::chrono::steady_clock::time_point epoch;
+	bool tracing = false;
+	size_t maxevents = 1000000;//per thread
+	
+	//Record rss change and peak rss per zone, reading /proc/self/status on zone entry and exit
+	//VmHWM is process-wide, so only the phase thread's top-level zones reset it (through /proc/self/clear_refs),
+	//and the peak of a zone is that of the whole process since the start of the current phase
+	bool memory = false;
+
+	//Record hardware counters per zone through a per-thread perf_event_open group
+	//Falls back to timing only, with one warning, if perf events are not permitted
+	bool counters = false;
+
+	cProfiler(){
+		epoch = std::chrono::steady_clock::now();
+		phasethread = std::this_thread::get_id();
+	};
+
+	//The thread whose top-level zones are the memory phases, by default the one that constructed the profiler
+	std::thread::id phasethread;
+
+	void setphasethread(){
+		phasethread = std::this_thread::get_id();
+	}
+
+	bool isphasethread() const {
+		return std::this_thread::get_id() == phasethread;
+	}
+
+	static cProfileTree& threadtree(){
+		static thread_local cProfileTree* t = nullptr;
+		if (t == nullptr){
+			static thread_local cProfileTree tree;
+			t = &tree;
+			gprofiler.add(t);
+		}
+		return *t;
+	}
+
+	static cPerfCounterGroup& threadcounters(){
+		static thread_local cPerfCounterGroup g;
+		static thread_local bool tried = false;
+		if (tried == false){
+			tried = true;
+			if (g.open() == false){
+				static std::once_flag warned;
+				std::call_once(warned, [](){
+					glog.logmsg("**Warning: Hardware performance counters are not available, profiling time only\n");
+				});
+			}
+		}
+		return g;
+	}
+
+	double now() const {
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	void add(cProfileTree* t){
+		std::lock_guard<std::mutex> lock(mtx);
+		t->threadid = nthreads++;
+		t->registered = true;
+		live.push_back(t);
+	}
+
+	void retire(cProfileTree* t){
+		std::lock_guard<std::mutex> lock(mtx);
+		retired.merge(*t);
+		retired.events.insert(retired.events.end(), t->events.begin(), t->events.end());
+		live.erase(std::remove(live.begin(), live.end(), t), live.end());
+	}
+
+	//Call when no zones are open in other threads, e.g. outside parallel regions
+	cProfileTree merged(){
+		std::lock_guard<std::mutex> lock(mtx);
+		cProfileTree m;
+		m.merge(retired);
+		for (size_t i = 0; i < live.size(); i++){
+			m.merge(*live[i]);
+		}
+		return m;
+	}
+
+	void reset(){
+		std::lock_guard<std::mutex> lock(mtx);
+		retired.clear();
+		for (size_t i = 0; i < live.size(); i++){
+			live[i]->clear();
+		}
+		epoch = std::chrono::steady_clock::now();
+	}
+
+	static std::string reportline(const std::string& name, const cProfileStats& s, const double& parenttotal, const size_t depth, const bool memory, const bool counters){
+		const double pc = parenttotal > 0.0 ? 100.0*s.total / parenttotal : 100.0;
+		std::string indent(2 * depth, ' ');
+		std::string line = strprint("%-40s %10zu %12.6lf %12.6lf %12.6lf %12.6lf %6.1lf%%",
+			(indent + name).c_str(), s.count, s.total, s.total / (double)s.count, s.min, s.max, pc);
+		if (memory) line += strprint(" %10.1lf %10.1lf", s.peakmemory / 1024.0, s.memorychange / 1024.0);
+		if (counters) line += strprint(" %6.2lf %12.3lf %12.3lf", s.counts.ipc(), 1.0e-6*(double)s.counts.cachemisses, 1.0e-6*(double)s.counts.branchmisses);
+		return line + "\n";
+	}
+
+	static void reportnode(const cProfileTree& t, const size_t node, const size_t depth, std::string& s, const bool memory, const bool counters){
+		const cProfileNode& n = t.nodes[node];
+		std::vector<size_t> c = n.children;
+		std::sort(c.begin(), c.end(), [&t](const size_t& a, const size_t& b){ return t.nodes[a].stats.total > t.nodes[b].stats.total; });
+		for (size_t i = 0; i < c.size(); i++){
+			const double parenttotal = node == 0 ? 0.0 : n.stats.total;
+			s += reportline(t.nodes[c[i]].name, t.nodes[c[i]].stats, parenttotal, depth, memory, counters);
+			reportnode(t, c[i], depth + 1, s, memory, counters);
+		}
+	}
+
+	static std::string reportstring(const cProfileTree& t, const bool memory = false, const bool counters = false){
+		std::string s = strprint("%-40s %10s %12s %12s %12s %12s %7s", "Zone", "Count", "Total(s)", "Mean(s)", "Min(s)", "Max(s)", "Parent");
+		if (memory) s += strprint(" %10s %10s", "Peak(MB)", "dRSS(MB)");
+		if (counters) s += strprint(" %6s %12s %12s", "IPC", "CacheMiss(M)", "BrMiss(M)");
+		s += "\n";
+		reportnode(t, 0, 0, s, memory, counters);
+		return s;
+	}
+
+	std::string reportstring(){
+		return reportstring(merged(), memory, counters);
+	}
+
+	void report(){
+		glog.logmsg("---Profile--------------------------------\n");
+		glog.logmsg(reportstring());
+		glog.logmsg("------------------------------------------\n");
+	}
+
+	//Chrome trace-event format, viewable in chrome://tracing or Perfetto
+	bool write_chrome_trace(const std::string& path, const int pid = 0){
+		FILE* fp = fopen(path.c_str(), "w");
+		if (fp == NULL){
+			glog.warningmsg(_SRC_, "Could not open profile trace file %s\n", path.c_str());
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		fprintf(fp, "{\"traceEvents\":[\n");
+		bool first = true;
+		auto write = [&](const std::vector<cProfileEvent>& ev){
+			for (size_t i = 0; i < ev.size(); i++){
+				fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3lf,\"dur\":%.3lf,\"pid\":%d,\"tid\":%d}",
+					first ? "" : ",\n", ev[i].name, ev[i].start, ev[i].duration, pid, ev[i].threadid);
+				first = false;
+			}
+		};
+		write(retired.events);
+		for (size_t i = 0; i < live.size(); i++){
+			write(live[i]->events);
+		}
+		fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		fclose(fp);
+		return true;
+	}
+
+#if defined _MPI_ENABLED
+	//Merge the trees of every rank onto the root rank, count/total/min/max are reduced per call path
+	cProfileTree merged(cMpiComm& comm, const int root = 0){
+		cProfileTree m = merged();
+		std::string s;
+		for (size_t i = 1; i < m.nodes.size(); i++){
+			const cProfileStats& st = m.nodes[i].stats;
+			s += strprint("%s\t%zu\t%.17g\t%.17g\t%.17g\t%lld\t%lld\t%llu\t%llu\t%llu\t%llu\n", m.path(i).c_str(), st.count, st.total, st.min, st.max,
+				(long long)st.peakmemory, (long long)st.memorychange,
+				(unsigned long long)st.counts.cycles, (unsigned long long)st.counts.instructions,
+				(unsigned long long)st.counts.cachemisses, (unsigned long long)st.counts.branchmisses);
+		}
+
+		int len = (int)s.size();
+		std::vector<int> lens(comm.size());
+		MPI_Gather(&len, 1, MPI_INT, lens.data(), 1, MPI_INT, root, comm);
+		std::vector<int> displs(comm.size(), 0);
+		for (size_t i = 1; i < displs.size(); i++) displs[i] = displs[i - 1] + lens[i - 1];
+		std::vector<char> all(comm.rank() == root ? displs.back() + lens.back() + 1 : 1, 0);
+		MPI_Gatherv((void*)s.data(), len, MPI_CHAR, all.data(), lens.data(), displs.data(), MPI_CHAR, root, comm);
+		if (comm.rank() != root) return m;
+
+		cProfileTree r;
+		std::vector<std::string> lines = split(std::string(all.data()), '\n');
+		for (size_t i = 0; i < lines.size(); i++){
+			std::vector<std::string> t = split(lines[i], '\t');
+			if (t.size() != 11) continue;
+			cProfileStats st;
+			st.count = (size_t)std::strtoull(t[1].c_str(), NULL, 10);
+			st.total = std::atof(t[2].c_str());
+			st.min = std::atof(t[3].c_str());
+			st.max = std::atof(t[4].c_str());
+			st.peakmemory = (int64_t)std::strtoll(t[5].c_str(), NULL, 10);
+			st.memorychange = (int64_t)std::strtoll(t[6].c_str(), NULL, 10);
+			st.counts.cycles = (uint64_t)std::strtoull(t[7].c_str(), NULL, 10);
+			st.counts.instructions = (uint64_t)std::strtoull(t[8].c_str(), NULL, 10);
+			st.counts.cachemisses = (uint64_t)std::strtoull(t[9].c_str(), NULL, 10);
+			st.counts.branchmisses = (uint64_t)std::strtoull(t[10].c_str(), NULL, 10);
+			r.nodes[r.findpath(t[0])].stats.merge(st);
+		}
+		return r;
+	}
+
+	void report(cMpiComm& comm, const int root = 0){
+		cProfileTree m = merged(comm, root);
+		if (comm.rank() != root) return;
+		glog.logmsg("---Profile (all ranks)--------------------\n");
+		glog.logmsg(reportstring(m, memory, counters));
+		glog.logmsg("------------------------------------------\n");
+	}
+#endif
+
+};
+
+inline cProfileTree::~cProfileTree(){
+	//Only the thread_local trees are registered, merge them into the registry as their thread exits
+	if (registered) gprofiler.retire(this);
+}
+
+//RAII timing zone, the name must be a string with static storage such as a literal
+class cProfileZone{
+
+	cProfileTree& tree;
+	const char* name;
+	size_t node;
+	double start;
+	int64_t rss = 0;
+	cPerfCounts counts;
+	bool countsvalid = false;
+
+public:
+
+	cProfileZone(const char* _name) : tree(cProfiler::threadtree()), name(_name){
+		node = tree.enter(name);
+		if (gprofiler.memory){
+			if (tree.nodes[node].parent == 0 && gprofiler.isphasethread()) cMemoryStatus::resetpeak();
+			rss = cMemoryStatus(false).rss;
+		}
+		if (gprofiler.counters){
+			countsvalid = cProfiler::threadcounters().read(counts);
+		}
+		start = gprofiler.now();
+	}
+
+	~cProfileZone(){
+		const double end = gprofiler.now();
+		const double t = end - start;
+		if (gprofiler.counters && countsvalid){
+			cPerfCounts now;
+			if (cProfiler::threadcounters().read(now)) tree.nodes[node].stats.counts += now - counts;
+		}
+		if (gprofiler.memory){
+			cMemoryStatus m(false);
+			tree.nodes[node].stats.addmemory(m.hwm, m.rss - rss);
+		}
+		tree.exit(node, 1.0e-6*t);
+		if (gprofiler.tracing && tree.events.size() < gprofiler.maxevents){
+			cProfileEvent e;
+			e.name = name;
+			e.threadid = tree.threadid;
+			e.start = start;
+			e.duration = t;
+			tree.events.push_back(e);
+		}
+	}
+};
+
+#endif
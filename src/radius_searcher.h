@@ -57,8 +57,8 @@ public:
 		x2 = max(x);
 		y1 = min(y);
 		y2 = max(y);
-		nxtiles = (size_t)ceil((x2 - x1) / radius);
-		nytiles = (size_t)ceil((y2 - y1) / radius);
+		nxtiles = (size_t)floor((x2 - x1) / radius) + 1;
+		nytiles = (size_t)floor((y2 - y1) / radius) + 1;
 
 		tiles.resize(nxtiles);
 		for (size_t i = 0; i < nxtiles; i++){
@@ -71,11 +71,15 @@ public:
 	};
 
 	size_t ixt(const double& px){
-		return (size_t)((px - x1) / radius);
+		if (px <= x1) return 0;
+		size_t t = (size_t)((px - x1) / radius);
+		return t < nxtiles ? t : nxtiles - 1;
 	}
 
 	size_t iyt(const double& py){
-		return (size_t)((py - y1) / radius);
+		if (py <= y1) return 0;
+		size_t t = (size_t)((py - y1) / radius);
+		return t < nytiles ? t : nytiles - 1;
 	}
 
 	void getsearchtilerange(const double& px, const double& py, size_t& tx1, size_t& tx2, size_t& ty1, size_t& ty2){
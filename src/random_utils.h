@@ -8,48 +8,456 @@ Author: Ross C. Brodie, Geoscience Australia.
 
 #ifndef _RANDOM_UTILS_H_
 #define _RANDOM_UTILS_H_
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
 #include <vector>
 #include <chrono>
 #include <random>
+#include <stdexcept>
+
+#if defined _OPENMP
+	#include <omp.h>
+#endif
+
+#include "general_constants.h"
+
+//SplitMix64, used to expand a single seed into engine state
+inline uint64_t splitmix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+};
+
+//xoshiro256++ (Blackman and Vigna), 32 bytes of state, period 2^256-1.
+//Satisfies UniformRandomBitGenerator so it can drive the std:: distributions.
+//jump() and long_jump() advance by 2^128 and 2^192 draws to give non-overlapping streams.
+class cXoshiro256pp{
+
+private:
+	uint64_t s[4];
+
+	static uint64_t rotl(const uint64_t x, const int k){
+		return (x << k) | (x >> (64 - k));
+	}
+
+	void jumpby(const uint64_t* J){
+		uint64_t t[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < 4; i++){
+			for (int b = 0; b < 64; b++){
+				if (J[i] & (1ULL << b)){
+					t[0] ^= s[0]; t[1] ^= s[1]; t[2] ^= s[2]; t[3] ^= s[3];
+				}
+				next();
+			}
+		}
+		s[0] = t[0]; s[1] = t[1]; s[2] = t[2]; s[3] = t[3];
+	}
+
+public:
+	typedef uint64_t result_type;
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT64_MAX; }
+
+	cXoshiro256pp(const uint64_t seedvalue = 1){
+		seed(seedvalue);
+	}
+
+	void seed(uint64_t seedvalue){
+		for (int i = 0; i < 4; i++) s[i] = splitmix64(seedvalue);
+	}
+
+	uint64_t next(){
+		const uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+		const uint64_t t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 45);
+		return result;
+	}
+
+	result_type operator()(){ return next(); }
+
+	//Uniform on [0,1) with 53 random bits
+	double uniform(){
+		return (double)(next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	void jump(){
+		static const uint64_t J[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+		jumpby(J);
+	}
+
+	void long_jump(){
+		static const uint64_t J[] = { 0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL };
+		jumpby(J);
+	}
+
+	void fill(uint64_t* x, const size_t n){
+		for (size_t i = 0; i < n; i++) x[i] = next();
+	}
+};
+
+//Pool of engines, one per OpenMP thread, padded to avoid false sharing.
+//seed(seed, process) gives thread t of process p the stream long_jump^p jump^t of the seeded engine,
+//so results are reproducible for a given seed, process (e.g. MPI rank) and thread.
+//Until seed() is called the pool is seeded from the clock, as the old per-call engines were.
+//Threads that are not OpenMP threads (or nested teams) all map to slot 0 and should use their own cXoshiro256pp from stream().
+class cRandomPool{
+
+private:
+	enum { MAXSLOTS = 256 };
+
+	struct alignas(64) sSlot{
+		cXoshiro256pp engine;
+	};
+
+	sSlot slots[MAXSLOTS];
+
+	cRandomPool(){
+		uint64_t t = (uint64_t)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+		std::random_device rd;
+		seed(t ^ ((uint64_t)rd() << 32));
+	}
+
+public:
+
+	static cRandomPool& instance(){
+		static cRandomPool pool;
+		return pool;
+	}
+
+	static size_t threadslot(){
+	#if defined _OPENMP
+		return (size_t)omp_get_thread_num();
+	#else
+		return 0;
+	#endif
+	}
+
+	//Not thread safe, call outside parallel regions
+	void seed(const uint64_t seedvalue, const uint64_t process = 0){
+		cXoshiro256pp e = stream(seedvalue, process, 0);
+		for (size_t i = 0; i < MAXSLOTS; i++){
+			slots[i].engine = e;
+			e.jump();
+		}
+	}
+
+	cXoshiro256pp& engine(){
+		return engine(threadslot());
+	}
+
+	cXoshiro256pp& engine(const size_t slot){
+		if (slot >= MAXSLOTS){
+			throw(std::runtime_error("cRandomPool::engine() thread number exceeds the number of engines"));
+		}
+		return slots[slot].engine;
+	}
+
+	//An independent engine for stream (process, thread), for threads not managed by OpenMP
+	static cXoshiro256pp stream(const uint64_t seedvalue, const uint64_t process, const uint64_t thread){
+		cXoshiro256pp e(seedvalue);
+		for (uint64_t i = 0; i < process; i++) e.long_jump();
+		for (uint64_t i = 0; i < thread; i++) e.jump();
+		return e;
+	}
+};
+
+//Philox4x32-10 counter based generator (Salmon et al. 2011, Random123).
+//Block k of stream s under key (seed) is a pure function of (seed, s, k), so bulk fills can be split across
+//threads or vector lanes in any way and give identical results. Each block of 128 bits gives two doubles,
+//either two uniforms or one Box-Muller pair of normals, so value i always comes from block i/2.
+//The fills work on batches laid out as separate arrays so the round function and the conversions vectorise.
+class cPhiloxRandom{
+
+private:
+	enum { BATCH = 64 };
+
+	//Rounds applied to BATCH counters at once, c0..c3 are overwritten with the output
+	static void rounds(uint32_t* c0, uint32_t* c1, uint32_t* c2, uint32_t* c3, uint32_t k0, uint32_t k1){
+		const uint64_t M0 = 0xD2511F53ULL;
+		const uint64_t M1 = 0xCD9E8D57ULL;
+		for (int r = 0; r < 10; r++){
+			for (size_t j = 0; j < BATCH; j++){
+				const uint64_t p0 = M0 * c0[j];
+				const uint64_t p1 = M1 * c2[j];
+				const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1[j] ^ k0;
+				const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3[j] ^ k1;
+				c1[j] = (uint32_t)p1;
+				c3[j] = (uint32_t)p0;
+				c0[j] = n0;
+				c2[j] = n2;
+			}
+			k0 += 0x9E3779B9U;
+			k1 += 0xBB67AE85U;
+		}
+	}
+
+	//Branch free log for u in (0,1] so the Box-Muller loop vectorises (std::log is an opaque call).
+	//u = m 2^e with m in [sqrt(1/2),sqrt(2)) and log(m) = 2 atanh((m-1)/(m+1)) by series, relative error ~1e-16
+	static double logunit(const double u){
+		uint64_t bits;
+		std::memcpy(&bits, &u, sizeof(bits));
+		//Exponent converted to double by planting it in the mantissa of 2^52, avoiding an int64 conversion
+		uint64_t ebits = (bits >> 52) | 0x4330000000000000ULL;
+		double e;
+		std::memcpy(&e, &ebits, sizeof(e));
+		e -= 4503599627370496.0 + 1023.0;
+		bits = (bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+		double m;
+		std::memcpy(&m, &bits, sizeof(m));
+		const bool big = m > 1.4142135623730951;
+		m = big ? 0.5 * m : m;
+		e = big ? e + 1.0 : e;
+		const double z = (m - 1.0) / (m + 1.0);
+		const double z2 = z * z;
+		double p = 1.0 / 21.0;
+		p = p * z2 + 1.0 / 19.0;
+		p = p * z2 + 1.0 / 17.0;
+		p = p * z2 + 1.0 / 15.0;
+		p = p * z2 + 1.0 / 13.0;
+		p = p * z2 + 1.0 / 11.0;
+		p = p * z2 + 1.0 / 9.0;
+		p = p * z2 + 1.0 / 7.0;
+		p = p * z2 + 1.0 / 5.0;
+		p = p * z2 + 1.0 / 3.0;
+		p = p * z2 + 1.0;
+		return 2.0 * z * p + e * 0.69314718055994531;
+	}
+
+	//sqrt(x) for x >= 0 by Newton iterations on 1/sqrt(x) from the bit level estimate. Unlike std::sqrt,
+	//which may set errno, this can be vectorised without -fno-math-errno
+	static double sqrtpositive(const double x){
+		uint64_t bits;
+		std::memcpy(&bits, &x, sizeof(bits));
+		bits = 0x5FE6EB50C7B537A9ULL - (bits >> 1);
+		double y;
+		std::memcpy(&y, &bits, sizeof(y));
+		const double h = 0.5 * x;
+		y = y * (1.5 - h * y * y);
+		y = y * (1.5 - h * y * y);
+		y = y * (1.5 - h * y * y);
+		y = y * (1.5 - h * y * y);
+		return x * y;
+	}
+
+	//Branch free sin(2 pi u) and cos(2 pi u) for u in [0,1), reduced to [-pi/4,pi/4] and a quadrant
+	static void sincosunit(const double u, double& s, double& c){
+		const double a = 4.0 * u;
+		const double k = (a + 4503599627370496.0) - 4503599627370496.0;//nearest integer, std::floor does not vectorise
+		const double x = (a - k) * 1.5707963267948966;
+		const double x2 = x * x;
+		double ps = -1.0 / 355687428096000.0;
+		ps = ps * x2 + 1.0 / 1307674368000.0;
+		ps = ps * x2 - 1.0 / 6227020800.0;
+		ps = ps * x2 + 1.0 / 39916800.0;
+		ps = ps * x2 - 1.0 / 362880.0;
+		ps = ps * x2 + 1.0 / 5040.0;
+		ps = ps * x2 - 1.0 / 120.0;
+		ps = ps * x2 + 1.0 / 6.0;
+		const double sx = x - x * x2 * ps;
+		double pc = 1.0 / 20922789888000.0;
+		pc = pc * x2 - 1.0 / 87178291200.0;
+		pc = pc * x2 + 1.0 / 479001600.0;
+		pc = pc * x2 - 1.0 / 3628800.0;
+		pc = pc * x2 + 1.0 / 40320.0;
+		pc = pc * x2 - 1.0 / 720.0;
+		pc = pc * x2 + 1.0 / 24.0;
+		pc = pc * x2 - 0.5;
+		const double cx = 1.0 + x2 * pc;
+		const double q = k > 3.5 ? 0.0 : k;
+		const double h = q > 1.5 ? 1.0 : 0.0;
+		const double odd = q - 2.0 * h;
+		const double ss = odd > 0.5 ? cx : sx;
+		const double cc = odd > 0.5 ? sx : cx;
+		s = h > 0.5 ? -ss : ss;
+		c = h + odd == 1.0 ? -cc : cc;//quadrants 1 and 2
+	}
+
+	//Two 53 bit uniforms per block, u0 on [0,1) and u1 on (0,1]
+	void batch(const uint64_t firstblock, double* u0, double* u1) const {
+		alignas(64) uint32_t c0[BATCH], c1[BATCH], c2[BATCH], c3[BATCH];
+		for (size_t j = 0; j < BATCH; j++){
+			const uint64_t b = firstblock + j;
+			c0[j] = (uint32_t)b;
+			c1[j] = (uint32_t)(b >> 32);
+			c2[j] = (uint32_t)stream;
+			c3[j] = (uint32_t)(stream >> 32);
+		}
+		rounds(c0, c1, c2, c3, (uint32_t)key, (uint32_t)(key >> 32));
+		const double scale = 1.0 / 9007199254740992.0;
+		for (size_t j = 0; j < BATCH; j++){
+			const uint64_t a = ((uint64_t)c1[j] << 32 | c0[j]) >> 11;
+			const uint64_t b = ((uint64_t)c3[j] << 32 | c2[j]) >> 11;
+			u0[j] = (double)a * scale;
+			u1[j] = (double)(b + 1) * scale;
+		}
+	}
+
+	static void boxmuller(const double* u0, const double* u1, double* v0, double* v1, const double mean, const double stddev){
+		for (size_t j = 0; j < BATCH; j++){
+			const double r = stddev * sqrtpositive(-2.0 * logunit(u1[j]));
+			double sn, cs;
+			sincosunit(u0[j], sn, cs);
+			v0[j] = mean + r * cs;
+			v1[j] = mean + r * sn;
+		}
+	}
+
+	static void scale(const double* u0, const double* u1, double* v0, double* v1, const double rmin, const double rmax){
+		const double range = rmax - rmin;
+		for (size_t j = 0; j < BATCH; j++){
+			v0[j] = rmin + range * u0[j];
+			v1[j] = rmin + range * (1.0 - u1[j]);
+		}
+	}
+
+	template<typename T>
+	void fill(const size_t n, T* x, const T& p1, const T& p2, const bool normal){
+		const size_t nblocks = (n + 1) / 2;
+		const size_t nbatches = (nblocks + BATCH - 1) / BATCH;
+		const uint64_t first = counter;
+		#if defined _OPENMP
+		#pragma omp parallel for schedule(static) if(nbatches >= 256)
+		#endif
+		for (long long bi = 0; bi < (long long)nbatches; bi++){
+			alignas(64) double u0[BATCH], u1[BATCH], v0[BATCH], v1[BATCH];
+			batch(first + (uint64_t)bi * BATCH, u0, u1);
+			if (normal) boxmuller(u0, u1, v0, v1, (double)p1, (double)p2);
+			else scale(u0, u1, v0, v1, (double)p1, (double)p2);
+			const size_t i0 = 2 * BATCH * (size_t)bi;
+			const size_t m = std::min((size_t)(2 * BATCH), n - i0);
+			T* y = x + i0;
+			for (size_t j = 0; 2 * j < m; j++){
+				y[2 * j] = (T)v0[j];
+				if (2 * j + 1 < m) y[2 * j + 1] = (T)v1[j];
+			}
+		}
+		counter = first + nbatches * BATCH;
+	}
+
+public:
+	uint64_t key;
+	uint64_t stream;
+	uint64_t counter = 0;//next unused block
+
+	cPhiloxRandom(const uint64_t seedvalue = 1, const uint64_t streamid = 0){
+		key = seedvalue;
+		stream = streamid;
+	}
+
+	//One raw 128 bit block
+	void block(const uint64_t blockindex, uint32_t out[4]) const {
+		uint32_t c0 = (uint32_t)blockindex, c1 = (uint32_t)(blockindex >> 32);
+		uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int r = 0; r < 10; r++){
+			const uint64_t p0 = 0xD2511F53ULL * c0;
+			const uint64_t p1 = 0xCD9E8D57ULL * c2;
+			const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+			const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+			c1 = (uint32_t)p1;
+			c3 = (uint32_t)p0;
+			c0 = n0;
+			c2 = n2;
+			k0 += 0x9E3779B9U;
+			k1 += 0xBB67AE85U;
+		}
+		out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+	}
+
+	//Fills consume whole batches of 64 blocks so consecutive calls never share blocks
+	template<typename T>
+	void urand(const size_t n, T* x, const T& rmin = 0.0, const T& rmax = 1.0){
+		fill(n, x, rmin, rmax, false);
+	}
+
+	template<typename T>
+	void nrand(const size_t n, T* x, const T& mean = 0.0, const T& stddev = 1.0){
+		fill(n, x, mean, stddev, true);
+	}
+
+	//Any contiguous container with data() and size(), e.g. std::vector or Eigen vectors
+	template<typename VecType, typename T>
+	void urand(VecType& x, const T& rmin, const T& rmax){
+		urand((size_t)x.size(), x.data(), (typename VecType::value_type)rmin, (typename VecType::value_type)rmax);
+	}
+
+	template<typename VecType, typename T>
+	void nrand(VecType& x, const T& mean, const T& stddev){
+		nrand((size_t)x.size(), x.data(), (typename VecType::value_type)mean, (typename VecType::value_type)stddev);
+	}
+};
+
+inline cXoshiro256pp& rngengine()
+{
+	return cRandomPool::instance().engine();
+};
+
+inline void rngseed(const uint64_t seedvalue, const uint64_t process = 0)
+{
+	cRandomPool::instance().seed(seedvalue, process);
+};
 
 template<typename T>
 T irand(const T& imin, const T& imax)
 {
-	std::mt19937 gen(std::chrono::system_clock::now().time_since_epoch().count());
 	std::uniform_int_distribution<T> dist(imin, imax);
-	return dist(gen);
+	return dist(rngengine());
+};
+
+template<typename T>
+void irand(size_t n, T* x, const T& imin, const T& imax)
+{
+	cXoshiro256pp& e = rngengine();
+	std::uniform_int_distribution<T> dist(imin, imax);
+	for (size_t i = 0; i < n; i++) {
+		x[i] = dist(e);
+	}
 };
 
 template<typename T>
 T urand(const T& rmin=0.0, const T& rmax=1.0)
 {
-	std::mt19937 gen(std::chrono::system_clock::now().time_since_epoch().count());
-	std::uniform_real_distribution<T> dist(rmin, rmax);
-	return dist(gen);	
+	return rmin + (rmax - rmin) * (T)rngengine().uniform();
+};
+
+template<typename T>
+void urand(size_t n, T* x, const T& rmin = 0.0, const T& rmax = 1.0)
+{
+	cXoshiro256pp& e = rngengine();
+	const T range = rmax - rmin;
+	for (size_t i = 0; i < n; i++) {
+		x[i] = rmin + range * (T)e.uniform();
+	}
 };
 
 template<typename T>
 T nrand(const T& mean = 0.0, const T& stddev = 1.0) {
-	std::mt19937 gen(std::chrono::system_clock::now().time_since_epoch().count());
-	std::normal_distribution<T> dist(mean, stddev);	
-	return dist(gen);
+	std::normal_distribution<T> dist(mean, stddev);
+	return dist(rngengine());
 };
 
+//Bulk normals from a Philox stream keyed by the calling thread's engine
 template<typename T>
 void nrand(size_t n, T* x, const T& mean=0.0, const T& stddev=1.0)
 {
-	std::mt19937 gen(std::chrono::system_clock::now().time_since_epoch().count());
-	std::normal_distribution<T> dist(mean, stddev);
-	for (size_t i = 0; i < n; i++) {
-		x[i] = dist(gen);
-	}
+	cPhiloxRandom p(rngengine().next());
+	p.nrand(n, x, mean, stddev);
 };
 
 template<typename T>
 std::vector<T> nrand(const size_t& n, const T& mean = 0.0, const T& stddev = 1.0)
-{	
+{
 	std::vector<T> x(n);
-	nrand<T>(x.data(), mean, stddev);	
+	nrand<T>(n, x.data(), mean, stddev);
 	return x;
 };
 
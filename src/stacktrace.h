@@ -10,6 +10,7 @@ Author: Ross C. Brodie, Geoscience Australia.
 #define _stacktrace_H
 
 #include <vector>
+#include <exception>
 #include "logger.h"
 
 //Should define USEGLOBALSTACKTRACE as a compiler preprocessor definition
@@ -34,27 +35,67 @@ class cStackTrace; //forward declaration only
 //extern only here - declare the actual global instance of the object in the main program .cpp file
 extern class cStackTrace gtrace; 
 
+//A trace frame holds only the static pointers from __FILE__ and __FUNCTION__, nothing is formatted until printed
+struct sTraceFrame {
+	const char* file;
+	const char* function;
+	int linenumber;
+};
+
+//Each thread has its own fixed-size trace stack so push/pop never allocate or race
 class cStackTrace {
 
-private:
-	std::vector<std::string> stack;
-	
 public:
+	enum { maxdepth = 256 };//an enum so it is never odr-used and needs no out of class definition
+
+	//Plain data so the thread_local is zero-initialised without a construction guard
+	//Frames are not popped while an exception unwinds, so in a catch handler depth is still the throw point
+	struct sThreadStack {
+		sTraceFrame frames[maxdepth];
+		size_t depth;
+	};
+
+	static sThreadStack& threadstack(){
+		static thread_local sThreadStack s;
+		return s;
+	}
 
 	cStackTrace(){ };
 	
-	void push(const char* file, const char* function, const int& linenumber){				
-		stack.push_back(cLogger::src_code_location(file, function, linenumber));
+	static size_t push(const char* file, const char* function, const int& linenumber){
+		sThreadStack& s = threadstack();
+		if (s.depth < maxdepth){
+			sTraceFrame& f = s.frames[s.depth];
+			f.file = file;
+			f.function = function;
+			f.linenumber = linenumber;
+		}
+		return s.depth++;
+	}
+
+	static void pop(){
+		sThreadStack& s = threadstack();
+		if (s.depth > 0) s.depth--;
 	}
 
-	void pop(){
-		stack.pop_back();
+	static void unwind(const size_t depth){
+		threadstack().depth = depth;
 	}
 
-	void printf(){		
+	static size_t depth(){
+		return threadstack().depth;
+	}
+
+	void printf(){
+		const sThreadStack& s = threadstack();
+		const size_t n = s.depth;
 		glog.logmsg("---Stack Trace----------------------------\n");
-		for (size_t i = stack.size(); i > 0; i--){
-			glog.logmsg("%s\n", stack[i-1].c_str());
+		if (n > maxdepth){
+			glog.logmsg("(%zu frames not recorded)\n", n - maxdepth);
+		}
+		for (size_t i = (n < maxdepth ? n : maxdepth); i > 0; i--){
+			const sTraceFrame& f = s.frames[i - 1];
+			glog.logmsg("%s\n", cLogger::src_code_location(f.file, f.function, f.linenumber).c_str());
 		}
 		glog.logmsg("------------------------------------------\n");
 	}	
@@ -62,28 +103,24 @@ public:
 
 class cTraceItem {
 
+private:
+	size_t index;
+
 public:
 
 	cTraceItem(const char* file, const char* function, const int& linenumber){
-		gtrace.push(file,function,linenumber);
+		index = cStackTrace::push(file, function, linenumber);
 	}
 
 	~cTraceItem(){
-		
+		//If an exception has not occurred, pop this frame (and any left by an earlier caught exception)
 	#if __cplusplus >= 201703
-		if (std::uncaught_exceptions() == 0) {
-			//If an Exception has not occurred, pop it off the global stack
-			gtrace.pop();
-		}
+		if (std::uncaught_exceptions() == 0) cStackTrace::unwind(index);
 	#else
-		if (std::uncaught_exception() == false) {
-			//If an Exception has not occurred, pop it off the global stack
-			gtrace.pop();
-		}
+		if (std::uncaught_exception() == false) cStackTrace::unwind(index);
 	#endif
 	}
         
 };
 
 #endif
-
@@ -0,0 +1,323 @@
+/*
+This source code file is licensed under the GNU GPL Version 2.0 Licence by the following copyright holder:
+Crown Copyright Commonwealth of Australia (Geoscience Australia) 2015.
+The GNU GPL 2.0 licence is available at: http://www.gnu.org/licenses/gpl-2.0.html. If you require a paper copy of the GNU GPL 2.0 Licence, please write to Free Software Foundation, Inc. 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+Author: Ross C. Brodie, Geoscience Australia.
+*/
+
+#ifndef _synthetic_survey_H
+#define _synthetic_survey_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "general_constants.h"
+#include "general_utils.h"
+#include "file_utils.h"
+#include "file_formats.h"
+#include "intrepid.h"
+
+//Synthetic AEM line data (flight lines, fiducials, X/Y, elevation, height and multi-window EM decays) for benchmarking readers and spatial searches.
+//The random stream is the same for a given seed everywhere: std::mt19937_64 is fully specified by the standard and the distributions are done here
+//rather than with std::*_distribution whose algorithms are implementation defined. The values go through std::log, sin, cos and pow from the
+//platform's maths library, which is not required to be correctly rounded, so files may differ in the last digits between platforms.
+class cSyntheticSurvey{
+
+private:
+	std::mt19937_64 rng;
+	bool havespare = false;
+	double spare = 0.0;
+
+	double uniform(){
+		return (double)(rng() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	double uniform(const double lo, const double hi){
+		return lo + (hi - lo) * uniform();
+	}
+
+	//Box-Muller, caching the second deviate
+	double gaussian(){
+		if (havespare){
+			havespare = false;
+			return spare;
+		}
+		double u1 = uniform();
+		double u2 = uniform();
+		if (u1 < 1e-300) u1 = 1e-300;
+		double r = std::sqrt(-2.0 * std::log(u1));
+		spare = r * std::sin(TWOPI * u2);
+		havespare = true;
+		return r * std::cos(TWOPI * u2);
+	}
+
+	//First order autoregressive step with stationary standard deviation sd
+	double ar1(const double previous, const double rho, const double sd){
+		return rho * previous + std::sqrt(1.0 - rho * rho) * sd * gaussian();
+	}
+
+public:
+
+	//Configuration
+	uint64_t seed = 1;
+	size_t nlines = 10;
+	size_t nsamples = 1000;//mean samples per line
+	double samplejitter = 0.1;//fractional variation of the samples per line
+	size_t nbands = 30;//EM windows
+	double x0 = 500000.0;
+	double y0 = 7000000.0;
+	double bearing = 0.0;//flight line direction in degrees clockwise from north
+	double linespacing = 200.0;
+	double samplespacing = 12.0;
+	double wander = 15.0;//standard deviation of the cross-track deviation from the nominal line
+	int firstlinenumber = 100010;
+	int lineincrement = 10;
+	double nullfraction = 0.0;//fraction of EM values replaced by nullvalue
+	double nullvalue = -9999.0;
+
+	//Generated data, one entry per sample except em which is nbands per sample
+	std::vector<int> linenumber;//per line
+	std::vector<size_t> linestart;//per line
+	std::vector<size_t> linesamples;//per line
+	std::vector<int> line;
+	std::vector<double> fiducial;
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> elevation;
+	std::vector<double> height;
+	std::vector<double> windowtimes;
+	std::vector<double> em;
+
+	cSyntheticSurvey(){ };
+
+	cSyntheticSurvey(const uint64_t _seed, const size_t _nlines, const size_t _nsamples, const size_t _nbands){
+		seed = _seed;
+		nlines = _nlines;
+		nsamples = _nsamples;
+		nbands = _nbands;
+		generate();
+	};
+
+	size_t ntotal() const { return fiducial.size(); }
+
+	const double* emsample(const size_t i) const { return &em[i * nbands]; }
+
+	void generate(){
+		rng.seed(seed);
+		havespare = false;
+
+		//Log spaced window centre times from 10us to 10ms
+		windowtimes.resize(nbands);
+		for (size_t bi = 0; bi < nbands; bi++){
+			double f = nbands > 1 ? (double)bi / (double)(nbands - 1) : 0.0;
+			windowtimes[bi] = std::pow(10.0, -5.0 + 3.0 * f);
+		}
+
+		linenumber.resize(nlines);
+		linestart.resize(nlines);
+		linesamples.resize(nlines);
+		size_t n = 0;
+		for (size_t li = 0; li < nlines; li++){
+			double f = 1.0 + samplejitter * uniform(-1.0, 1.0);
+			size_t ns = (size_t)std::llround(f * (double)nsamples);
+			if (ns < 2) ns = 2;
+			linenumber[li] = firstlinenumber + (int)li * lineincrement;
+			linestart[li] = n;
+			linesamples[li] = ns;
+			n += ns;
+		}
+
+		line.resize(n);
+		fiducial.resize(n);
+		x.resize(n);
+		y.resize(n);
+		elevation.resize(n);
+		height.resize(n);
+		em.resize(n * nbands);
+
+		//Smooth terrain as a sum of a few randomly oriented plane waves
+		const size_t nwaves = 4;
+		double wk[nwaves][3];
+		for (size_t wi = 0; wi < nwaves; wi++){
+			double a = uniform(0.0, TWOPI);
+			double lambda = uniform(2000.0, 20000.0);
+			wk[wi][0] = TWOPI * std::sin(a) / lambda;
+			wk[wi][1] = TWOPI * std::cos(a) / lambda;
+			wk[wi][2] = uniform(0.0, TWOPI);
+		}
+
+		const double b = D2R * bearing;
+		const double dx = std::sin(b), dy = std::cos(b);//along line
+		const double px = dy, py = -dx;//across line
+		const double linelength = (double)nsamples * samplespacing;
+		double fid = 1000.0;
+		for (size_t li = 0; li < nlines; li++){
+			const size_t ns = linesamples[li];
+			const size_t k0 = linestart[li];
+			const double ox = x0 + (double)li * linespacing * px;
+			const double oy = y0 + (double)li * linespacing * py;
+			const bool reverse = (li % 2) == 1;
+
+			double w = wander * gaussian();
+			double h = 5.0 * gaussian();
+			double logamp = 0.5 * gaussian();
+			double decay = 0.2 * gaussian();
+			for (size_t si = 0; si < ns; si++){
+				const size_t k = k0 + si;
+				double a = (double)si * samplespacing;
+				if (reverse) a = linelength - a;
+				w = ar1(w, 0.995, wander);
+				h = ar1(h, 0.98, 5.0);
+				logamp = ar1(logamp, 0.99, 0.5);
+				decay = ar1(decay, 0.99, 0.2);
+
+				line[k] = linenumber[li];
+				fiducial[k] = fid;
+				fid += 1.0;
+				x[k] = ox + a * dx + w * px;
+				y[k] = oy + a * dy + w * py;
+
+				double e = 100.0;
+				for (size_t wi = 0; wi < nwaves; wi++){
+					e += 20.0 * std::sin(wk[wi][0] * x[k] + wk[wi][1] * y[k] + wk[wi][2]);
+				}
+				elevation[k] = e + 0.2 * gaussian();
+				height[k] = 60.0 + h;
+
+				//Power law decay with correlated amplitude and exponent and 3% multiplicative noise
+				const double alpha = 1.5 + decay;
+				const double amp = std::pow(10.0, logamp) * std::pow(60.0 / height[k], 3.0);
+				double* d = &em[k * nbands];
+				for (size_t bi = 0; bi < nbands; bi++){
+					double v = amp * std::pow(windowtimes[bi] / 1.0e-5, -alpha);
+					v *= 1.0 + 0.03 * gaussian();
+					if (nullfraction > 0.0 && uniform() < nullfraction) v = nullvalue;
+					d[bi] = v;
+				}
+			}
+			fid += 100.0;//time between lines
+		}
+	}
+
+	cOutputFileInfo outputfileinfo() const {
+		cOutputFileInfo O;
+		O.addfield("Line", 'I', 10, 0);
+		O.addfield("Fiducial", 'F', 12, 1);
+		O.addfield("Easting", 'F', 12, 2);
+		O.setunits("m");
+		O.addfield("Northing", 'F', 12, 2);
+		O.setunits("m");
+		O.addfield("Elevation", 'F', 10, 2);
+		O.setunits("m");
+		O.addfield("Height", 'F', 10, 2);
+		O.setunits("m");
+		O.addfield("EM", 'E', 15, 6, nbands);
+		O.setunits("pV/Am^4");
+		O.setnullvalue(strprint("%.1lf", nullvalue));
+		O.setcomment("synthetic power law decays");
+		return O;
+	}
+
+	//Fixed width ASEG-GDF2 data file and its DFN header
+	bool write_aseggdf(const std::string& datpath, const std::string& dfnpath) const {
+		cOutputFileInfo O = outputfileinfo();
+		O.write_aseggdf_header(dfnpath);
+
+		FILE* fp = fileopen(datpath, "w");
+		if (fp == NULL) return false;
+		std::string r;
+		r.reserve(O.recordwidth() + 1);
+		for (size_t k = 0; k < ntotal(); k++){
+			r.clear();
+			O.formatfield(r, 0, (double)line[k]);
+			O.formatfield(r, 1, fiducial[k]);
+			O.formatfield(r, 2, x[k]);
+			O.formatfield(r, 3, y[k]);
+			O.formatfield(r, 4, elevation[k]);
+			O.formatfield(r, 5, height[k]);
+			O.formatfield(r, 6, emsample(k));
+			r += '\n';
+			fwrite(r.data(), 1, r.size(), fp);
+		}
+		fclose(fp);
+		return true;
+	}
+
+	bool write_csv(const std::string& path) const {
+		FILE* fp = fileopen(path, "w");
+		if (fp == NULL) return false;
+		fprintf(fp, "Line,Fiducial,Easting,Northing,Elevation,Height");
+		for (size_t bi = 0; bi < nbands; bi++) fprintf(fp, ",EM_%zu", bi + 1);
+		fprintf(fp, "\n");
+		for (size_t k = 0; k < ntotal(); k++){
+			fprintf(fp, "%d,%.1lf,%.2lf,%.2lf,%.2lf,%.2lf", line[k], fiducial[k], x[k], y[k], elevation[k], height[k]);
+			const double* d = emsample(k);
+			for (size_t bi = 0; bi < nbands; bi++) fprintf(fp, ",%.6le", d[bi]);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+		return true;
+	}
+
+	//Intrepid line dataset, the path may end in ..DIR
+	bool write_intrepid(const std::string& datasetpath) const {
+		ILDataset D;
+		if (D.create_new(datasetpath, linesamples) == false) return false;
+		D.addsurveyinfo("LineNumber", "Line");
+		D.addsurveyinfo("X", "Easting");
+		D.addsurveyinfo("Y", "Northing");
+
+		bool status = true;
+		status &= D.addfield("Line", IDataType(IDataType::ID::INT), 1, false);
+		status &= D.addfield("Fiducial", IDataType(IDataType::ID::DOUBLE));
+		status &= D.addfield("Easting", IDataType(IDataType::ID::DOUBLE));
+		status &= D.addfield("Northing", IDataType(IDataType::ID::DOUBLE));
+		status &= D.addfield("Elevation", IDataType(IDataType::ID::FLOAT));
+		status &= D.addfield("Height", IDataType(IDataType::ID::FLOAT));
+		status &= D.addfield("EM", IDataType(IDataType::ID::FLOAT), nbands);
+		if (status == false) return false;
+
+		std::vector<double> v;
+		for (size_t li = 0; li < nlines; li++){
+			const size_t k0 = linestart[li];
+			const size_t ns = linesamples[li];
+
+			ILSegment sl(D.getfield("Line"), li);
+			sl.createbuffer();
+			sl.setband(std::vector<int>(1, linenumber[li]));
+			status &= sl.writebuffer();
+
+			auto writeband = [&](const std::string& name, const std::vector<double>& a){
+				ILSegment s(D.getfield(name), li);
+				s.createbuffer();
+				s.setband(std::vector<double>(a.begin() + k0, a.begin() + k0 + ns));
+				status &= s.writebuffer();
+			};
+			writeband("Fiducial", fiducial);
+			writeband("Easting", x);
+			writeband("Northing", y);
+			writeband("Elevation", elevation);
+			writeband("Height", height);
+
+			ILSegment se(D.getfield("EM"), li);
+			se.createbuffer();
+			v.resize(ns);
+			for (size_t bi = 0; bi < nbands; bi++){
+				for (size_t si = 0; si < ns; si++){
+					const double d = em[(k0 + si) * nbands + bi];
+					v[si] = d == nullvalue ? (double)IDataType::floatnull() : d;
+				}
+				se.setband(v, bi);
+			}
+			status &= se.writebuffer();
+		}
+		return status;
+	}
+};
+
+#endif